@@ -0,0 +1,283 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "DataSource.h"
+#include "Matrix.h"
+
+namespace gmlp
+{
+
+// Serves the samples of X and y as shuffled mini-batches which a background
+// thread gathers into contiguous aligned buffers ahead of time, so the
+// training does not wait for the data. Every epoch, i.e. every rewind, uses
+// a new permutation. With a shuffle window the rows are only shuffled within
+// consecutive windows of that many rows and the windows are visited in a
+// random order, which keeps the reads local for memory-mapped data. X and y
+// must outlive the pipeline.
+class BatchPipeline : public DataSource
+{
+public:
+    BatchPipeline(const ConstMatrixView X,
+                  const ConstMatrixView y,
+                  const std::size_t batch_size,
+                  const std::size_t seed,
+                  const std::size_t shuffle_window = 0,
+                  const std::size_t queue_depth = 2)
+        : X_{X}, y_{y}, batch_size_{batch_size}, shuffle_window_{shuffle_window},
+          random_engine_{static_cast<std::default_random_engine::result_type>(seed)},
+          buffers_(queue_depth + 1, Matrix{batch_size, X.get_cols() + y.get_cols()})
+    {
+        assert(X.get_rows() == y.get_rows());
+        assert(batch_size > 0);
+        assert(queue_depth > 0);
+        for (auto& buffer : buffers_)
+        {
+            free_.push_back(&buffer);
+        }
+        producer_ = std::thread{[this] { produce(); }};
+    }
+
+    ~BatchPipeline()
+    {
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            done_ = true;
+        }
+        changed_.notify_all();
+        producer_.join();
+    }
+
+    BatchPipeline(const BatchPipeline&) = delete;
+    BatchPipeline& operator=(const BatchPipeline&) = delete;
+
+    std::size_t get_x_cols() const override
+    {
+        return X_.get_cols();
+    }
+
+    std::size_t get_y_cols() const override
+    {
+        return y_.get_cols();
+    }
+
+    // Starts a new epoch. The batches gathered so far are kept if none of the
+    // current epoch has been read yet. Otherwise the rest of the current
+    // epoch is dropped and the batches which the producer prefetched for
+    // the next one are served right away.
+    void rewind() override
+    {
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            if (n_read_ == 0)
+            {
+                return;
+            }
+            release_current();
+            for (const auto& batch : ready_)
+            {
+                release(batch.buffer);
+            }
+            ready_ = std::move(next_ready_);
+            next_ready_.clear();
+            n_read_ = 0;
+            ++epoch_;
+        }
+        changed_.notify_all();
+    }
+
+    bool next(ConstMatrixView& X,
+              ConstMatrixView& y) override
+    {
+        std::unique_lock<std::mutex> lock{mutex_};
+        release_current();
+        changed_.notify_all();
+        if (ready_.empty())
+        {
+            const auto start = std::chrono::steady_clock::now();
+            ready_changed_.wait(lock, [this] { return !ready_.empty(); });
+            stall_seconds_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            ++n_stalls_;
+        }
+        const auto batch = ready_.front();
+        ready_.pop_front();
+        ++n_read_;
+        if (!batch.buffer)
+        {
+            ready_.push_front(batch); // the end of the epoch stays until a rewind
+            return false;
+        }
+        current_ = batch.buffer;
+        const auto rows = current_->get_view().get_row_range(0, batch.n_rows);
+        X = rows.get_col_range(0, X_.get_cols());
+        y = rows.get_col_range(X_.get_cols(), y_.get_cols());
+        return true;
+    }
+
+    // the number of gathered batches waiting to be read
+    std::size_t get_queue_depth() const
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        return static_cast<std::size_t>(std::count_if(ready_.begin(), ready_.end(),
+                                                      [](const Batch& batch) { return batch.buffer; }));
+    }
+
+    // how often and how long next had to wait for a batch
+    std::size_t get_stall_count() const
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        return n_stalls_;
+    }
+
+    double get_stall_seconds() const
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        return stall_seconds_;
+    }
+
+private:
+    // a null buffer marks the end of an epoch
+    struct Batch
+    {
+        Matrix* buffer;
+        std::size_t n_rows;
+    };
+
+    void release(Matrix* buffer)
+    {
+        if (buffer)
+        {
+            free_.push_back(buffer);
+        }
+    }
+
+    void release_current()
+    {
+        release(current_);
+        current_ = nullptr;
+    }
+
+    std::vector<std::size_t> make_permutation()
+    {
+        std::vector<std::size_t> permutation(X_.get_rows());
+        std::iota(permutation.begin(), permutation.end(), std::size_t{0});
+        if (shuffle_window_ == 0)
+        {
+            std::shuffle(permutation.begin(), permutation.end(), random_engine_);
+            return permutation;
+        }
+        std::vector<std::size_t> windows((permutation.size() + shuffle_window_ - 1) / shuffle_window_);
+        std::iota(windows.begin(), windows.end(), std::size_t{0});
+        std::shuffle(windows.begin(), windows.end(), random_engine_);
+        std::vector<std::size_t> shuffled;
+        shuffled.reserve(permutation.size());
+        for (const auto window : windows)
+        {
+            const auto begin = permutation.begin() + static_cast<std::ptrdiff_t>(window * shuffle_window_);
+            const auto end = permutation.begin() + static_cast<std::ptrdiff_t>(std::min((window + 1) * shuffle_window_,
+                                                                                        permutation.size()));
+            std::shuffle(begin, end, random_engine_);
+            shuffled.insert(shuffled.end(), begin, end);
+        }
+        return shuffled;
+    }
+
+    void gather(const std::vector<std::size_t>& permutation,
+                const std::size_t begin,
+                const std::size_t n_rows,
+                Matrix& buffer) const
+    {
+        for (std::size_t r = 0; r < n_rows; ++r)
+        {
+            const auto row = permutation[begin + r];
+            float* out = buffer.get_row(r);
+            out = std::copy(X_.get_row(row), X_.get_row(row) + X_.get_cols(), out);
+            std::copy(y_.get_row(row), y_.get_row(row) + y_.get_cols(), out);
+        }
+    }
+
+    // the queue for the batches of epoch, which is the current or the next
+    std::deque<Batch>& get_queue(const std::size_t epoch)
+    {
+        return epoch == epoch_ ? ready_ : next_ready_;
+    }
+
+    // Gathers the batches of the current epoch and, once its end is queued,
+    // prefetches the next epoch into the buffers which the consumer frees,
+    // so that a rewind finds batches waiting. A rewind in the middle of an
+    // epoch drops the epoch being gathered.
+    void produce()
+    {
+        std::unique_lock<std::mutex> lock{mutex_};
+        std::size_t epoch = 0;
+        for (;;)
+        {
+            changed_.wait(lock, [this, &epoch] { return done_ || epoch <= epoch_ + 1; });
+            if (done_)
+            {
+                return;
+            }
+            epoch = std::max(epoch, epoch_);
+            lock.unlock();
+            const auto permutation = make_permutation();
+            lock.lock();
+            for (std::size_t begin = 0; begin < permutation.size() && epoch >= epoch_; begin += batch_size_)
+            {
+                changed_.wait(lock, [this, epoch] { return done_ || epoch < epoch_ || !free_.empty(); });
+                if (done_ || epoch < epoch_)
+                {
+                    break;
+                }
+                Matrix* buffer = free_.back();
+                free_.pop_back();
+                const auto n_rows = std::min(batch_size_, permutation.size() - begin);
+                lock.unlock();
+                gather(permutation, begin, n_rows, *buffer);
+                lock.lock();
+                if (epoch < epoch_)
+                {
+                    release(buffer);
+                    break;
+                }
+                get_queue(epoch).push_back({buffer, n_rows});
+                ready_changed_.notify_one();
+            }
+            if (!done_ && epoch >= epoch_)
+            {
+                get_queue(epoch).push_back({nullptr, 0});
+                ready_changed_.notify_one();
+                ++epoch;
+            }
+        }
+    }
+
+    const ConstMatrixView X_;
+    const ConstMatrixView y_;
+    const std::size_t batch_size_;
+    const std::size_t shuffle_window_;
+    std::default_random_engine random_engine_;
+    std::vector<Matrix> buffers_;
+    mutable std::mutex mutex_;
+    std::condition_variable changed_; // wakes the producer
+    std::condition_variable ready_changed_; // wakes the consumer
+    std::vector<Matrix*> free_;
+    std::deque<Batch> ready_;
+    std::deque<Batch> next_ready_; // prefetched batches of the next epoch
+    Matrix* current_ = nullptr;
+    std::size_t epoch_ = 0;
+    std::size_t n_read_ = 0;
+    std::size_t n_stalls_ = 0;
+    double stall_seconds_ = 0;
+    bool done_ = false;
+    std::thread producer_;
+};
+
+}
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+#include "csv.h"
+#include "Dataset.h"
+#include "Matrix.h"
+
+namespace gmlp
+{
+
+// A source of samples which are read chunk by chunk so that datasets larger
+// than the memory can be trained on. A source holds at most one chunk at a
+// time.
+class DataSource
+{
+public:
+    virtual ~DataSource() = default;
+    virtual std::size_t get_x_cols() const = 0;
+    virtual std::size_t get_y_cols() const = 0;
+    // starts again from the first sample
+    virtual void rewind() = 0;
+    // Sets X and y to the features and targets of the next chunk of samples
+    // and returns false once all samples have been read. The views stay valid
+    // until the next call.
+    virtual bool next(ConstMatrixView& X,
+                      ConstMatrixView& y) = 0;
+};
+
+// Serves the rows of a dataset in chunks without copying, e.g. of a
+// memory-mapped binary dataset file. The OS pages the file in as the chunks
+// are read and may drop the pages of earlier chunks under memory pressure.
+class DatasetSource : public DataSource
+{
+public:
+    DatasetSource(Dataset dataset,
+                  const std::size_t chunk_rows)
+        : dataset_{std::move(dataset)}, chunk_rows_{chunk_rows}
+    {
+        assert(chunk_rows_ > 0);
+    }
+
+    DatasetSource(const std::string& path,
+                  const std::size_t chunk_rows)
+        : DatasetSource{Dataset::map(path), chunk_rows}
+    {}
+
+    std::size_t get_x_cols() const override
+    {
+        return dataset_.get_X().get_cols();
+    }
+
+    std::size_t get_y_cols() const override
+    {
+        return dataset_.get_y().get_cols();
+    }
+
+    void rewind() override
+    {
+        row_ = 0;
+    }
+
+    bool next(ConstMatrixView& X,
+              ConstMatrixView& y) override
+    {
+        if (row_ == dataset_.get_rows())
+        {
+            return false;
+        }
+        const auto n_rows = std::min(chunk_rows_, dataset_.get_rows() - row_);
+        X = dataset_.get_X().get_row_range(row_, n_rows);
+        y = dataset_.get_y().get_row_range(row_, n_rows);
+        row_ += n_rows;
+        return true;
+    }
+
+private:
+    const Dataset dataset_;
+    const std::size_t chunk_rows_;
+    std::size_t row_ = 0;
+};
+
+// Parses a text file line by line while reading it, see csv::read for the
+// format. Throws std::runtime_error on malformed lines.
+class CsvSource : public DataSource
+{
+public:
+    CsvSource(const std::string& path,
+              const std::size_t chunk_rows,
+              const csv::Options& options = {})
+        : path_{path}, chunk_rows_{chunk_rows}, options_{options}, file_{path}
+    {
+        assert(chunk_rows_ > 0);
+        if (!file_)
+        {
+            throw std::runtime_error{"cannot open " + path};
+        }
+        rewind();
+        // the columns of the first line define the layout
+        std::string line;
+        long n_cols = 0;
+        while (n_cols == 0 && std::getline(file_, line))
+        {
+            if (csv::detail::is_data_line(line.data(), line.data() + line.size()))
+            {
+                n_cols = csv::detail::parse_line(line.data(), line.data() + line.size(),
+                                                 options_.delimiter, [](std::size_t, float) {});
+            }
+        }
+        if (n_cols < 0)
+        {
+            throw std::runtime_error{path + ": malformed value in the first line"};
+        }
+        n_file_cols_ = static_cast<std::size_t>(n_cols);
+        layout_ = csv::detail::make_layout(path, n_file_cols_, options_);
+        chunk_ = Matrix{chunk_rows_, layout_.x_cols + layout_.y_cols};
+        rewind();
+    }
+
+    std::size_t get_x_cols() const override
+    {
+        return layout_.x_cols;
+    }
+
+    std::size_t get_y_cols() const override
+    {
+        return layout_.y_cols;
+    }
+
+    void rewind() override
+    {
+        file_.clear();
+        file_.seekg(0);
+        line_number_ = 0;
+        std::string line;
+        while (line_number_ < options_.skip_lines && std::getline(file_, line))
+        {
+            ++line_number_;
+        }
+    }
+
+    bool next(ConstMatrixView& X,
+              ConstMatrixView& y) override
+    {
+        std::size_t n_rows = 0;
+        while (n_rows < chunk_rows_ && std::getline(file_, line_))
+        {
+            ++line_number_;
+            const char* begin = line_.data();
+            const char* end = begin + line_.size();
+            if (!csv::detail::is_data_line(begin, end))
+            {
+                continue;
+            }
+            float* out = chunk_.get_row(n_rows);
+            const auto n_cols = csv::detail::parse_line(begin, end, options_.delimiter,
+                                                        [&](const std::size_t col, const float value)
+            {
+                if (col < n_file_cols_ && layout_.column_map[col] != csv::detail::unused)
+                {
+                    out[layout_.column_map[col]] = value;
+                }
+            });
+            if (n_cols < 0 || static_cast<std::size_t>(n_cols) != n_file_cols_)
+            {
+                throw std::runtime_error{path_ + ": malformed line " + std::to_string(line_number_)};
+            }
+            ++n_rows;
+        }
+        const auto rows = chunk_.get_view().get_row_range(0, n_rows);
+        X = rows.get_col_range(0, layout_.x_cols);
+        y = rows.get_col_range(layout_.x_cols, layout_.y_cols);
+        return n_rows > 0;
+    }
+
+private:
+    const std::string path_;
+    const std::size_t chunk_rows_;
+    const csv::Options options_;
+    std::ifstream file_;
+    std::size_t n_file_cols_ = 0;
+    csv::detail::Layout layout_;
+    Matrix chunk_;
+    std::string line_;
+    std::size_t line_number_ = 0;
+};
+
+// Produces n_rows samples by calling generator(row, x, y) which writes the
+// features and targets of the given row to x and y.
+class GeneratorSource : public DataSource
+{
+public:
+    using Generator = std::function<void(std::size_t, float*, float*)>;
+
+    GeneratorSource(const std::size_t n_rows,
+                    const std::size_t x_cols,
+                    const std::size_t y_cols,
+                    const std::size_t chunk_rows,
+                    Generator generator)
+        : n_rows_{n_rows}, x_cols_{x_cols}, y_cols_{y_cols},
+          generator_{std::move(generator)}, chunk_{chunk_rows, x_cols + y_cols}
+    {
+        assert(chunk_rows > 0);
+    }
+
+    std::size_t get_x_cols() const override
+    {
+        return x_cols_;
+    }
+
+    std::size_t get_y_cols() const override
+    {
+        return y_cols_;
+    }
+
+    void rewind() override
+    {
+        row_ = 0;
+    }
+
+    bool next(ConstMatrixView& X,
+              ConstMatrixView& y) override
+    {
+        const auto n_rows = std::min(chunk_.get_rows(), n_rows_ - row_);
+        for (std::size_t i = 0; i < n_rows; ++i)
+        {
+            generator_(row_ + i, chunk_.get_row(i), chunk_.get_row(i) + x_cols_);
+        }
+        row_ += n_rows;
+        const auto rows = chunk_.get_view().get_row_range(0, n_rows);
+        X = rows.get_col_range(0, x_cols_);
+        y = rows.get_col_range(x_cols_, y_cols_);
+        return n_rows > 0;
+    }
+
+private:
+    const std::size_t n_rows_;
+    const std::size_t x_cols_;
+    const std::size_t y_cols_;
+    const Generator generator_;
+    Matrix chunk_;
+    std::size_t row_ = 0;
+};
+
+}
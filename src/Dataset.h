@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "half.h"
+#include "MappedFile.h"
+#include "Matrix.h"
+
+namespace gmlp
+{
+
+// Header of the binary dataset format. It is followed by zero padding up
+// to data_offset, a multiple of alignment, and then the rows x (x_cols +
+// y_cols) row-major values in the native byte order, the features of a row
+// followed by its targets.
+struct DatasetHeader
+{
+    char magic[8];
+    std::uint32_t version;
+    DataType data_type;
+    std::uint64_t rows;
+    std::uint64_t x_cols;
+    std::uint64_t y_cols;
+    std::uint64_t alignment;
+    std::uint64_t data_offset;
+};
+
+// The features X and targets y of a set of samples, one row per sample.
+// Both are column ranges of one row-major matrix which is either owned by
+// the dataset or a memory-mapped binary dataset file. A mapped dataset is
+// copy-on-write so its values may be modified without touching the file.
+class Dataset
+{
+public:
+    static constexpr char magic[8] = {'G', 'M', 'L', 'P', 'D', 'A', 'T', 'A'};
+    static constexpr std::uint32_t version = 1;
+
+    Dataset() = default;
+
+    // the first x_cols columns of data are the features, the rest the targets
+    Dataset(Matrix data,
+            const std::size_t x_cols)
+        : matrix_{std::move(data)}, data_{matrix_}, x_cols_{x_cols}
+    {
+        assert(x_cols_ <= data_.get_cols());
+    }
+
+    Dataset(const Dataset&) = delete;
+    Dataset& operator=(const Dataset&) = delete;
+    Dataset(Dataset&&) = default;
+    Dataset& operator=(Dataset&&) = default;
+
+    // Maps a file written by save without reading or copying the values.
+    // Throws std::runtime_error if the file is not a valid dataset.
+    static Dataset map(const std::string& path)
+    {
+        Dataset dataset;
+        dataset.file_ = MappedFile{path};
+        const auto size = dataset.file_.get_size();
+        DatasetHeader header;
+        if (size < sizeof(header))
+        {
+            throw std::runtime_error{path + " is not a dataset"};
+        }
+        std::memcpy(&header, dataset.file_.get_data(), sizeof(header));
+        if (std::memcmp(header.magic, magic, sizeof(magic)) != 0)
+        {
+            throw std::runtime_error{path + " is not a dataset"};
+        }
+        if (header.version != version || header.data_type != DataType::Float32)
+        {
+            throw std::runtime_error{path + " has an unsupported version or data type"};
+        }
+        const auto cols = header.x_cols + header.y_cols;
+        if (header.data_offset < sizeof(header)
+            || header.data_offset > size
+            || header.data_offset % alignof(float) != 0
+            || (cols > 0 && header.rows > (size - header.data_offset) / sizeof(float) / cols))
+        {
+            throw std::runtime_error{path + " is truncated or corrupt"};
+        }
+        auto* values = reinterpret_cast<float*>(dataset.file_.get_data() + header.data_offset);
+        dataset.data_ = MatrixView{values, static_cast<std::size_t>(header.rows), static_cast<std::size_t>(cols)};
+        dataset.x_cols_ = static_cast<std::size_t>(header.x_cols);
+        return dataset;
+    }
+
+    // Writes the dataset in the binary format. The values start at a multiple
+    // of alignment bytes from the beginning of the file.
+    void save(const std::string& path,
+              const std::size_t alignment = 64) const
+    {
+        std::ofstream os{path, std::ios::binary};
+        if (!os)
+        {
+            throw std::runtime_error{"cannot open " + path};
+        }
+        save(os, alignment);
+        if (!os)
+        {
+            throw std::runtime_error{"cannot write " + path};
+        }
+    }
+
+    void save(std::ostream& os,
+              const std::size_t alignment = 64) const
+    {
+        assert(alignment > 0 && alignment % alignof(float) == 0);
+        DatasetHeader header;
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.version = version;
+        header.data_type = DataType::Float32;
+        header.rows = data_.get_rows();
+        header.x_cols = x_cols_;
+        header.y_cols = data_.get_cols() - x_cols_;
+        header.alignment = alignment;
+        header.data_offset = (sizeof(header) + alignment - 1) / alignment * alignment;
+        os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        const std::vector<char> padding(header.data_offset - sizeof(header));
+        os.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+        for (std::size_t i = 0; i < data_.get_rows(); ++i)
+        {
+            os.write(reinterpret_cast<const char*>(data_.get_row(i)),
+                     static_cast<std::streamsize>(data_.get_cols() * sizeof(float)));
+        }
+    }
+
+    std::size_t get_rows() const
+    {
+        return data_.get_rows();
+    }
+
+    ConstMatrixView get_X() const
+    {
+        return data_.get_col_range(0, x_cols_);
+    }
+
+    MatrixView get_X()
+    {
+        return data_.get_col_range(0, x_cols_);
+    }
+
+    ConstMatrixView get_y() const
+    {
+        return data_.get_col_range(x_cols_, data_.get_cols() - x_cols_);
+    }
+
+    MatrixView get_y()
+    {
+        return data_.get_col_range(x_cols_, data_.get_cols() - x_cols_);
+    }
+
+private:
+    Matrix matrix_;
+    MappedFile file_;
+    MatrixView data_;
+    std::size_t x_cols_ = 0;
+};
+
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace gmlp
+{
+
+// Maps a whole file into memory. The mapping is copy-on-write: the memory
+// may be modified but changes only affect this process and are never written
+// back to the file. Pages are loaded lazily by the OS so opening is cheap
+// regardless of the file size. Throws std::runtime_error if the file cannot
+// be mapped.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+
+    explicit
+    MappedFile(const std::string& path)
+    {
+#ifdef _WIN32
+        const HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            throw std::runtime_error{"cannot open " + path};
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size))
+        {
+            CloseHandle(file);
+            throw std::runtime_error{"cannot get the size of " + path};
+        }
+        size_ = static_cast<std::size_t>(size.QuadPart);
+        if (size_ > 0)
+        {
+            const HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+            if (mapping)
+            {
+                data_ = static_cast<char*>(MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0));
+                CloseHandle(mapping); // the view keeps the mapping alive
+            }
+        }
+        CloseHandle(file);
+        if (size_ > 0 && !data_)
+        {
+            throw std::runtime_error{"cannot map " + path};
+        }
+#else
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw std::runtime_error{"cannot open " + path};
+        }
+        struct stat status;
+        if (::fstat(fd, &status) != 0)
+        {
+            ::close(fd);
+            throw std::runtime_error{"cannot get the size of " + path};
+        }
+        size_ = static_cast<std::size_t>(status.st_size);
+        if (size_ > 0)
+        {
+            void* data = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED)
+            {
+                data_ = static_cast<char*>(data);
+            }
+        }
+        ::close(fd); // the mapping keeps the file alive
+        if (size_ > 0 && !data_)
+        {
+            throw std::runtime_error{"cannot map " + path};
+        }
+#endif
+    }
+
+    ~MappedFile()
+    {
+        unmap();
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept
+        : data_{std::exchange(other.data_, nullptr)}, size_{std::exchange(other.size_, 0)}
+    {}
+
+    MappedFile& operator=(MappedFile&& other) noexcept
+    {
+        if (this != &other)
+        {
+            unmap();
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+        }
+        return *this;
+    }
+
+    char* get_data() const
+    {
+        return data_;
+    }
+
+    std::size_t get_size() const
+    {
+        return size_;
+    }
+
+private:
+    void unmap()
+    {
+        if (data_)
+        {
+#ifdef _WIN32
+            UnmapViewOfFile(data_);
+#else
+            ::munmap(data_, size_);
+#endif
+            data_ = nullptr;
+            size_ = 0;
+        }
+    }
+
+    char* data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+}
@@ -0,0 +1,270 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace gmlp
+{
+
+// std::allocator replacement returning memory aligned to Alignment bytes
+template<typename T, std::size_t Alignment = 64>
+class AlignedAllocator
+{
+public:
+    using value_type = T;
+
+    template<typename U>
+    struct rebind
+    {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() = default;
+
+    template<typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&)
+    {}
+
+    T* allocate(const std::size_t n)
+    {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t{Alignment}));
+    }
+
+    void deallocate(T* p, std::size_t)
+    {
+        ::operator delete(p, std::align_val_t{Alignment});
+    }
+
+    friend bool operator==(const AlignedAllocator&, const AlignedAllocator&)
+    {
+        return true;
+    }
+
+    friend bool operator!=(const AlignedAllocator&, const AlignedAllocator&)
+    {
+        return false;
+    }
+};
+
+// A non-owning view of a rows x cols row-major matrix whose rows start
+// stride values apart. T is float or const float, a view of float converts
+// to a view of const float.
+template<typename T>
+class BasicMatrixView
+{
+public:
+    BasicMatrixView() = default;
+
+    BasicMatrixView(T* data,
+                    const std::size_t rows,
+                    const std::size_t cols)
+        : BasicMatrixView{data, rows, cols, cols}
+    {}
+
+    BasicMatrixView(T* data,
+                    const std::size_t rows,
+                    const std::size_t cols,
+                    const std::size_t stride)
+        : data_{data}, rows_{rows}, cols_{cols}, stride_{stride}
+    {
+        assert(stride >= cols);
+    }
+
+    template<typename U, typename = std::enable_if_t<std::is_same<T, const U>::value>>
+    BasicMatrixView(const BasicMatrixView<U>& other)
+        : BasicMatrixView{other.get_data(), other.get_rows(), other.get_cols(), other.get_stride()}
+    {}
+
+    T* get_data() const
+    {
+        return data_;
+    }
+
+    std::size_t get_rows() const
+    {
+        return rows_;
+    }
+
+    std::size_t get_cols() const
+    {
+        return cols_;
+    }
+
+    std::size_t get_stride() const
+    {
+        return stride_;
+    }
+
+    // whether the rows follow each other without gaps
+    bool is_contiguous() const
+    {
+        return stride_ == cols_ || rows_ <= 1;
+    }
+
+    T* get_row(const std::size_t row) const
+    {
+        assert(row < rows_);
+        return data_ + row * stride_;
+    }
+
+    T& operator()(const std::size_t row,
+                  const std::size_t col) const
+    {
+        assert(col < cols_);
+        return get_row(row)[col];
+    }
+
+    // the n rows starting at row begin
+    BasicMatrixView get_row_range(const std::size_t begin,
+                                  const std::size_t n) const
+    {
+        assert(begin + n <= rows_);
+        return {data_ + begin * stride_, n, cols_, stride_};
+    }
+
+    // the n columns starting at column begin, the stride is kept
+    BasicMatrixView get_col_range(const std::size_t begin,
+                                  const std::size_t n) const
+    {
+        assert(begin + n <= cols_);
+        return {data_ + begin, rows_, n, stride_};
+    }
+
+private:
+    T* data_ = nullptr;
+    std::size_t rows_ = 0;
+    std::size_t cols_ = 0;
+    std::size_t stride_ = 0;
+};
+
+using MatrixView = BasicMatrixView<float>;
+using ConstMatrixView = BasicMatrixView<const float>;
+
+// A rows x cols row-major matrix in one contiguous 64 byte aligned buffer.
+// Converts to a MatrixView or, if const, to a ConstMatrixView.
+class Matrix
+{
+public:
+    Matrix() = default;
+
+    Matrix(const std::size_t rows,
+           const std::size_t cols,
+           const float value = 0.0f)
+        : rows_{rows}, cols_{cols}, values_(rows * cols, value)
+    {}
+
+    // copies the view into contiguous storage
+    explicit
+    Matrix(const ConstMatrixView view)
+        : Matrix{view.get_rows(), view.get_cols()}
+    {
+        for (std::size_t i = 0; i < rows_; ++i)
+        {
+            std::copy(view.get_row(i), view.get_row(i) + cols_, get_row(i));
+        }
+    }
+
+    std::size_t get_rows() const
+    {
+        return rows_;
+    }
+
+    std::size_t get_cols() const
+    {
+        return cols_;
+    }
+
+    std::size_t get_stride() const
+    {
+        return cols_;
+    }
+
+    const float* get_data() const
+    {
+        return values_.data();
+    }
+
+    float* get_data()
+    {
+        return values_.data();
+    }
+
+    const float* get_row(const std::size_t row) const
+    {
+        assert(row < rows_);
+        return values_.data() + row * cols_;
+    }
+
+    float* get_row(const std::size_t row)
+    {
+        assert(row < rows_);
+        return values_.data() + row * cols_;
+    }
+
+    const float& operator()(const std::size_t row,
+                            const std::size_t col) const
+    {
+        assert(col < cols_);
+        return get_row(row)[col];
+    }
+
+    float& operator()(const std::size_t row,
+                      const std::size_t col)
+    {
+        assert(col < cols_);
+        return get_row(row)[col];
+    }
+
+    ConstMatrixView get_view() const
+    {
+        return {values_.data(), rows_, cols_};
+    }
+
+    MatrixView get_view()
+    {
+        return {values_.data(), rows_, cols_};
+    }
+
+    operator ConstMatrixView() const
+    {
+        return get_view();
+    }
+
+    operator MatrixView()
+    {
+        return get_view();
+    }
+
+private:
+    std::size_t rows_ = 0;
+    std::size_t cols_ = 0;
+    std::vector<float, AlignedAllocator<float>> values_;
+};
+
+// copies rows of equal size into a matrix
+inline Matrix to_matrix(const std::vector<std::vector<float>>& rows)
+{
+    Matrix matrix{rows.size(), rows.empty() ? 0 : rows.front().size()};
+    for (std::size_t i = 0; i < rows.size(); ++i)
+    {
+        assert(rows[i].size() == matrix.get_cols());
+        std::copy(rows[i].begin(), rows[i].end(), matrix.get_row(i));
+    }
+    return matrix;
+}
+
+inline std::vector<std::vector<float>> to_rows(const ConstMatrixView matrix)
+{
+    std::vector<std::vector<float>> rows;
+    for (std::size_t i = 0; i < matrix.get_rows(); ++i)
+    {
+        rows.emplace_back(matrix.get_row(i), matrix.get_row(i) + matrix.get_cols());
+    }
+    return rows;
+}
+
+}
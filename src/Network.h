@@ -1,107 +1,184 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
 
+#include "DataSource.h"
+#include "half.h"
+#include "kernels.h"
 #include "loss.h"
+#include "MappedFile.h"
+#include "Matrix.h"
 #include "Neuron.h"
+#include "optimizer.h"
+#include "ThreadPool.h"
+#include "Topology.h"
+#include "WeightBuffer.h"
 
 namespace gmlp
 {
 
-enum TargetType : std::uint8_t
+// Header of the model file format. It is followed by layer_count uint64
+// layer sizes, zero padding up to weights_offset, a multiple of alignment,
+// and then weight_count weights of data_type in the native byte order. The
+// checksum covers the header with a zero checksum field, the layer sizes
+// and the weights.
+struct ModelHeader
 {
-    Classification,
-    Regression,
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order; // BasicNetwork::byte_order as stored by the saving machine
+    DataType data_type;
+    TargetType target_type;
+    std::uint8_t reserved[3] = {};
+    std::uint64_t layer_count;
+    std::uint64_t weight_count;
+    std::uint64_t alignment;
+    std::uint64_t weights_offset;
+    std::uint64_t checksum;
 };
 
-class Network
+namespace detail
 {
-public:
-    Network(const TargetType target_type,
-            const std::vector<std::size_t>& layers,
-            init::RandomEngine& random_engine)
-        : target_type_{target_type}
+
+// A 64-bit FNV-1a style hash over 8-byte words, it detects corruption but
+// is not meant to be cryptographically secure.
+inline std::uint64_t checksum(const char* data,
+                              const std::size_t size,
+                              std::uint64_t hash = 0xcbf29ce484222325)
+{
+    constexpr std::uint64_t prime = 0x100000001b3;
+    std::size_t i = 0;
+    for (; i + sizeof(std::uint64_t) <= size; i += sizeof(std::uint64_t))
     {
-        assert(layers.size() > 0);
-        layers_.resize(layers.size());
-        std::size_t current_layer = 0;
+        std::uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * prime;
+        hash ^= hash >> 29;
+    }
+    for (; i < size; ++i)
+    {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * prime;
+    }
+    return hash;
+}
 
-        if (layers.size() > 1)
-        {
-            // input layer
-            assert(layers[current_layer] > 0);
-            for (std::size_t i = 0; i < layers[current_layer]; ++i)
-            {
-                layers_[current_layer].transfer = std::make_unique<transfer::Sigmoid>();
-                add_neuron(layers_[current_layer], random_engine, layers[current_layer]);
-            }
-            ++current_layer;
+}
 
-            // hidden layers
-            for (; current_layer + 1 < layers.size(); ++current_layer)
-            {
-                assert(layers[current_layer] > 0);
-                for (std::size_t i = 0; i < layers[current_layer]; ++i)
-                {
-                    layers_[current_layer].transfer = std::make_unique<transfer::Sigmoid>();
-                    add_neuron(layers_[current_layer], random_engine, layers[current_layer - 1]);
-                }
-            }
-        }
+// Reusable ping-pong activation buffers for Network::predict. A workspace
+// must not be shared between threads, use one per thread instead.
+class Workspace
+{
+public:
+    Workspace() = default;
+
+    explicit
+    Workspace(const std::size_t size)
+    {
+        reserve(size);
+    }
 
-        // output layer
-        assert(current_layer + 1 == layers.size());
-        assert(layers[current_layer] > 0);
-        for (std::size_t i = 0; i < layers[current_layer]; ++i)
+    void reserve(const std::size_t size)
+    {
+        for (auto& buffer : buffers_)
         {
-            switch (target_type)
+            if (buffer.size() < size)
             {
-                case TargetType::Classification:
-                {
-                    layers_[current_layer].transfer = std::make_unique<transfer::Sigmoid>();
-                    break;
-                }
-                case TargetType::Regression:
-                {
-                    layers_[current_layer].transfer = std::make_unique<transfer::Linear>();
-                    break;
-                }
+                buffer.resize(size);
             }
-            add_neuron(layers_[current_layer], random_engine, layers[current_layer - 1]);
         }
+    }
+
+    float* get_buffer(const std::size_t index)
+    {
+        return buffers_[index % buffers_.size()].data();
+    }
 
-        // loss
-        assert(layers.back() > 0);
-        switch (target_type)
+    float* get_packed_weights(const std::size_t size)
+    {
+        if (packed_weights_.size() < size)
         {
-            case TargetType::Classification:
-            {
-                if (layers.back() > 1)
-                {
-                    loss_ = std::make_unique<loss::CE>();
-                }
-                else
-                {
-                    loss_ = std::make_unique<loss::SE>();
-                }
-                break;
-            }
-            case TargetType::Regression:
-            {
-                loss_ = std::make_unique<loss::SE>();
-                break;
-            }
+            packed_weights_.resize(size);
         }
+        return packed_weights_.data();
+    }
+
+private:
+    std::array<std::vector<float>, 2> buffers_;
+    std::vector<float> packed_weights_;
+};
+
+// A multilayer perceptron whose weights are stored as T. With bfloat16 or
+// float16 the weights take half the memory and memory bandwidth, which is
+// what limits the inference of wide networks and of large populations. The
+// kernels widen the weights to float as they load them, so all arithmetic
+// and the activations stay in float. Only float networks can be trained,
+// convert() turns a trained network into a 16-bit one.
+template<typename T>
+class BasicNetwork
+{
+public:
+    static constexpr char magic[8] = {'G', 'M', 'L', 'P', 'M', 'O', 'D', 'L'};
+    static constexpr std::uint32_t version = 2;
+    static constexpr std::uint32_t byte_order = 0x01020304;
+
+    // number of rows which predict_batch passes through the network at once
+    static constexpr std::size_t predict_tile_size = 64;
+
+    // smallest batch for which predict_batch packs the weights, the same
+    // threshold as in kernels::gemm_nt
+    static constexpr std::size_t pack_min_rows = 16;
+
+    // number of rows per shard of the deterministic parallel training
+    static constexpr std::size_t deterministic_shard_size = 16;
+
+    // number of gradient buffers which the deterministic parallel training
+    // fills concurrently
+    static constexpr std::size_t deterministic_max_buffers = 32;
+
+    BasicNetwork(const TargetType target_type,
+                 const std::vector<std::size_t>& layers,
+                 init::RandomEngine& random_engine)
+        : BasicNetwork{std::make_shared<const Topology>(target_type, layers), random_engine}
+    {}
+
+    // a network with xavier initialized weights which shares the topology
+    BasicNetwork(std::shared_ptr<const Topology> topology,
+                 init::RandomEngine& random_engine)
+        : BasicNetwork{std::move(topology)}
+    {
+        std::vector<float> values(topology_->get_weight_count());
+        topology_->initialize(random_engine, values.data());
+        std::vector<T> weights(values.size());
+        gmlp::convert(values.data(), weights.data(), weights.size());
+        weights_ = WeightBuffer<T>{std::move(weights)};
+    }
+
+    // a network which shares the topology with the given weights
+    BasicNetwork(std::shared_ptr<const Topology> topology,
+                 std::vector<T> weights)
+        : BasicNetwork{std::move(topology)}
+    {
+        assert(weights.size() == topology_->get_weight_count());
+        weights_ = WeightBuffer<T>{std::move(weights)};
     }
 
     void print() const
     {
-        std::cout << "Network arch (" << layers_.size() << "): ";
-        for (const Layer& layer : layers_)
+        const auto& layers = topology_->get_layers();
+        std::cout << "Network arch (" << layers.size() << "): ";
+        for (const Layer& layer : layers)
         {
             std::cout << layer.neurons.size();
-            if (&layer != &layers_.back())
+            if (&layer != &layers.back())
             {
                 std::cout << " -> ";
             }
@@ -111,218 +188,1263 @@ public:
 
     TargetType get_target_type() const
     {
-        return target_type_;
+        return topology_->get_target_type();
     }
 
     std::vector<std::size_t> get_layers() const
     {
-        std::vector<std::size_t> layers;
-        for (const Layer& layer : layers_)
-        {
-            layers.push_back(layer.neurons.size());
-        }
-        return layers;
+        return topology_->get_layer_sizes();
     }
 
-    const std::vector<float>& get_weights() const
+    std::size_t get_input_count() const
+    {
+        return topology_->get_layers().front().n_inputs;
+    }
+
+    std::size_t get_output_count() const
+    {
+        return topology_->get_layers().back().neurons.size();
+    }
+
+    const std::shared_ptr<const Topology>& get_topology() const
+    {
+        return topology_;
+    }
+
+    transfer::Precision get_precision() const
+    {
+        return precision_;
+    }
+
+    // the accuracy of the sigmoid and tanh transfers, the approximations are
+    // several times cheaper than the exact functions
+    void set_precision(const transfer::Precision precision)
+    {
+        precision_ = precision;
+    }
+
+    // null if the training uses plain SGD
+    const optimizer::Optimizer* get_optimizer() const
+    {
+        return optimizer_.get();
+    }
+
+    // Sets the optimizer which applies the gradients, plain SGD if null. The
+    // per-sample training updates the weights through the optimizer with
+    // batches of one sample then, and train_hogwild always uses plain SGD.
+    void set_optimizer(std::unique_ptr<optimizer::Optimizer> optimizer)
+    {
+        optimizer_ = std::move(optimizer);
+    }
+
+    const WeightBuffer<T>& get_weights() const
     {
         return weights_;
     }
 
-    std::vector<float>& get_weights()
+    WeightBuffer<T>& get_weights()
     {
         return weights_;
     }
 
-    void set_weights(std::vector<float> weights)
+    void set_weights(std::vector<T> weights)
     {
         assert(weights_.size() == weights.size());
-        weights_ = std::move(weights);
+        weights_ = WeightBuffer<T>{std::move(weights)};
+    }
+
+    // Writes the network to a model file: a ModelHeader, the layer sizes,
+    // zero padding and the weights as data_type starting at a multiple of
+    // alignment bytes, so that map can use them in place. Throws
+    // std::runtime_error if the file cannot be written.
+    void save(const std::string& path,
+              const DataType data_type = get_data_type<T>(),
+              const std::size_t alignment = 64) const
+    {
+        std::ofstream os{path, std::ios::binary};
+        if (!os)
+        {
+            throw std::runtime_error{"cannot open " + path};
+        }
+        save(os, data_type, alignment);
+        if (!os)
+        {
+            throw std::runtime_error{"cannot write " + path};
+        }
+    }
+
+    // Writes the same model format to a stream. The weights are rounded to
+    // nearest even if data_type is narrower than T.
+    void save(std::ostream& os,
+              const DataType data_type = get_data_type<T>(),
+              const std::size_t alignment = 64) const
+    {
+        assert(alignment > 0 && alignment % alignof(float) == 0);
+        std::vector<std::uint64_t> layers;
+        for (const Layer& layer : topology_->get_layers())
+        {
+            layers.push_back(layer.neurons.size());
+        }
+        std::vector<float> values(weights_.size());
+        gmlp::convert(weights_.data(), values.data(), values.size());
+        std::vector<char> bytes(values.size() * get_size(data_type));
+        switch (data_type)
+        {
+            case DataType::Float32: gmlp::convert(values.data(), reinterpret_cast<float*>(bytes.data()), values.size()); break;
+            case DataType::BFloat16: gmlp::convert(values.data(), reinterpret_cast<bfloat16*>(bytes.data()), values.size()); break;
+            case DataType::Float16: gmlp::convert(values.data(), reinterpret_cast<float16*>(bytes.data()), values.size()); break;
+        }
+        const auto layer_bytes = layers.size() * sizeof(std::uint64_t);
+        ModelHeader header;
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.version = version;
+        header.byte_order = byte_order;
+        header.data_type = data_type;
+        header.target_type = topology_->get_target_type();
+        header.layer_count = layers.size();
+        header.weight_count = weights_.size();
+        header.alignment = alignment;
+        header.weights_offset = (sizeof(header) + layer_bytes + alignment - 1) / alignment * alignment;
+        header.checksum = compute_checksum(header, reinterpret_cast<const char*>(layers.data()), bytes.data());
+        write(os, header);
+        os.write(reinterpret_cast<const char*>(layers.data()), static_cast<std::streamsize>(layer_bytes));
+        const std::vector<char> padding(header.weights_offset - sizeof(header) - layer_bytes);
+        os.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+        os.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
     }
 
-    void save(std::ostream& os)
+    // Maps a model file written by save(path) and builds the network around
+    // it without the random initialization. Weights stored as T are used in
+    // place, others are converted to T. Verifying the checksum reads the
+    // whole file once, without it the OS pages the weights in on first use.
+    // Throws std::runtime_error if the file is not a valid model, fails the
+    // checksum or was written on a machine with another byte order.
+    static BasicNetwork map(const std::string& path,
+                            const bool verify_checksum = true)
     {
-        write(os, target_type_);
-        write(os, layers_.size());
-        for (const Layer& layer : layers_)
+        MappedFile file{path};
+        const auto size = file.get_size();
+        ModelHeader header;
+        if (size < sizeof(header))
+        {
+            throw std::runtime_error{path + " is not a model"};
+        }
+        std::memcpy(&header, file.get_data(), sizeof(header));
+        check_header(header, path);
+        if (header.layer_count > (size - sizeof(header)) / sizeof(std::uint64_t)
+            || header.weights_offset < sizeof(header) + header.layer_count * sizeof(std::uint64_t)
+            || header.weights_offset > size
+            || header.weight_count > (size - header.weights_offset) / get_size(header.data_type))
+        {
+            throw std::runtime_error{path + " is truncated or corrupt"};
+        }
+        const char* layer_data = file.get_data() + sizeof(header);
+        const auto layers = read_layers(header, layer_data, path);
+        const char* bytes = file.get_data() + header.weights_offset;
+        if (verify_checksum && compute_checksum(header, layer_data, bytes) != header.checksum)
         {
-            write(os, layer.neurons.size());
+            throw std::runtime_error{path + " fails the checksum"};
         }
-        write(os, weights_.size());
-        for (const auto& value : weights_)
+
+        BasicNetwork net{std::make_shared<const Topology>(header.target_type, layers)};
+        const auto n_weights = static_cast<std::size_t>(header.weight_count);
+        if (header.data_type == get_data_type<T>() && header.weights_offset % alignof(T) == 0)
         {
-            write(os, value);
+            net.weights_ = WeightBuffer<T>{std::move(file), static_cast<std::size_t>(header.weights_offset), n_weights};
+            return net;
         }
+        net.weights_ = WeightBuffer<T>{convert_values(header.data_type, bytes, n_weights)};
+        return net;
     }
 
-    static Network load(std::istream& is)
+    // Reads a model written by either save, converting the weights to T. It
+    // also reads the stream format of earlier versions, which has no header.
+    // Throws std::runtime_error if the stream does not hold a valid model or
+    // ends early.
+    static BasicNetwork load(std::istream& is)
     {
-        TargetType target_type;
-        read(is, target_type);
-        std::size_t layer_count;
-        read(is, layer_count);
-        std::vector<std::size_t> layers(layer_count);
-        for (auto& value : layers)
+        if (is.peek() != magic[0])
+        {
+            return load_unversioned(is);
+        }
+        ModelHeader header;
+        if (!read(is, header))
+        {
+            throw std::runtime_error{"the stream is not a model"};
+        }
+        check_header(header, "the stream");
+        std::vector<std::uint64_t> layer_data;
+        std::uint64_t value;
+        while (layer_data.size() < header.layer_count && read(is, value))
+        {
+            layer_data.push_back(value);
+        }
+        const auto layer_bytes = layer_data.size() * sizeof(std::uint64_t);
+        if (!is || header.weights_offset < sizeof(header) + layer_bytes)
+        {
+            throw std::runtime_error{"the stream is truncated or corrupt"};
+        }
+        const auto layers = read_layers(header, reinterpret_cast<const char*>(layer_data.data()), "the stream");
+        is.ignore(static_cast<std::streamsize>(header.weights_offset - sizeof(header) - layer_bytes));
+        std::vector<char> bytes(static_cast<std::size_t>(header.weight_count) * get_size(header.data_type));
+        is.read(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        if (!is)
         {
-            read(is, value);
+            throw std::runtime_error{"the stream is truncated"};
         }
-        std::size_t weight_count;
-        read(is, weight_count);
-        std::vector<float> weights(weight_count);
-        for (auto& value : weights)
+        if (compute_checksum(header, reinterpret_cast<const char*>(layer_data.data()), bytes.data()) != header.checksum)
         {
-            read(is, value);
+            throw std::runtime_error{"the stream fails the checksum"};
         }
-        init::DefaultRandomEngine random_engine{1};
-        Network net{static_cast<TargetType>(target_type), layers, random_engine};
-        net.set_weights(weights);
+        BasicNetwork net{std::make_shared<const Topology>(header.target_type, layers)};
+        net.weights_ = WeightBuffer<T>{convert_values(header.data_type, bytes.data(), bytes.size() / get_size(header.data_type))};
         return net;
     }
 
-    Network clone() const
+    // a copy of the network which stores its weights as U
+    template<typename U>
+    BasicNetwork<U> convert() const
     {
-        init::DefaultRandomEngine random_engine{1};
-        Network cloned{get_target_type(), get_layers(), random_engine};
-        cloned.set_weights(get_weights());
+        BasicNetwork<U> converted{topology_};
+        std::vector<float> values(weights_.size());
+        gmlp::convert(weights_.data(), values.data(), values.size());
+        std::vector<U> weights(weights_.size());
+        gmlp::convert(values.data(), weights.data(), weights.size());
+        converted.weights_ = WeightBuffer<U>{std::move(weights)};
+        converted.set_precision(get_precision());
+        return converted;
+    }
+
+    BasicNetwork clone() const
+    {
+        BasicNetwork cloned{topology_};
+        cloned.weights_ = weights_;
+        cloned.set_precision(get_precision());
+        if (optimizer_)
+        {
+            cloned.set_optimizer(optimizer_->clone());
+        }
         return cloned;
     }
 
+    float train(const ConstMatrixView X,
+                const ConstMatrixView y,
+                const float learning_rate)
+    {
+        auto loss = train_samples(X, y, learning_rate);
+        topology_->get_loss().transform_error(loss);
+        return loss;
+    }
+
     float train(const std::vector<std::vector<float>>& X,
                 const std::vector<std::vector<float>>& y,
                 const float learning_rate)
     {
-        assert(X.size() == y.size());
+        return train(to_matrix(X), to_matrix(y), learning_rate);
+    }
+
+    // Mini-batch gradient descent. Each layer processes the whole batch as one
+    // matrix-matrix product, the gradients are averaged over the batch and
+    // applied in a single update per batch.
+    float train(const ConstMatrixView X,
+                const ConstMatrixView y,
+                const float learning_rate,
+                const std::size_t batch_size)
+    {
+        auto loss = train_batches(X, y, learning_rate, batch_size);
+        topology_->get_loss().transform_error(loss);
+        return loss;
+    }
+
+    float train(const std::vector<std::vector<float>>& X,
+                const std::vector<std::vector<float>>& y,
+                const float learning_rate,
+                const std::size_t batch_size)
+    {
+        return train(to_matrix(X), to_matrix(y), learning_rate, batch_size);
+    }
+
+    // Trains one epoch over all samples of the source reading one chunk at a
+    // time, so the memory used does not depend on the size of the dataset.
+    float train(DataSource& source,
+                const float learning_rate)
+    {
+        assert(source.get_x_cols() == get_input_count());
+        assert(source.get_y_cols() == get_output_count());
+        source.rewind();
         float loss = 0;
-        for (std::size_t i = 0; i < X.size(); ++i)
+        ConstMatrixView X;
+        ConstMatrixView y;
+        while (source.next(X, y))
         {
-            const auto output = forward(X[i]);
-            std::vector<float> deltas;
-            loss += loss_multi_output(deltas, y[i], output);
-            backward(std::move(deltas));
-            update(learning_rate);
+            loss += train_samples(X, y, learning_rate);
         }
-        loss_->transform_error(loss);
+        topology_->get_loss().transform_error(loss);
         return loss;
     }
 
-    std::vector<float> predict(const std::vector<float>& input) const
+    // Same with mini-batches, a batch does not span chunks so the chunk size
+    // should be a multiple of the batch size.
+    float train(DataSource& source,
+                const float learning_rate,
+                const std::size_t batch_size)
+    {
+        assert(source.get_x_cols() == get_input_count());
+        assert(source.get_y_cols() == get_output_count());
+        source.rewind();
+        float loss = 0;
+        ConstMatrixView X;
+        ConstMatrixView y;
+        while (source.next(X, y))
+        {
+            loss += train_batches(X, y, learning_rate, batch_size);
+        }
+        topology_->get_loss().transform_error(loss);
+        return loss;
+    }
+
+    // Synchronous data-parallel mini-batch gradient descent. Each batch is
+    // split into shards whose gradients are computed concurrently into
+    // separate buffers, summed by a pairwise tree reduction and applied in a
+    // single update. By default there is one shard per thread and one
+    // gradient buffer per thread. If deterministic is set the shards have a
+    // fixed size of deterministic_shard_size rows instead, so that the
+    // weights come out bit for bit the same for any number of threads,
+    // including a pool of one thread. The shards then go through waves of
+    // at most deterministic_max_buffers buffers, each summed into a running
+    // total, which bounds the memory to deterministic_max_buffers + 1
+    // gradient buffers for any batch size. The deterministic weights only
+    // equal those of train(X, y, learning_rate, batch_size) if batch_size is
+    // at most deterministic_shard_size, larger batches sum their gradients in
+    // another order.
+    float train(const ConstMatrixView X,
+                const ConstMatrixView y,
+                const float learning_rate,
+                const std::size_t batch_size,
+                ThreadPool& pool,
+                const bool deterministic = false)
+    {
+        assert(X.get_rows() == y.get_rows());
+        assert(X.get_cols() == get_input_count());
+        assert(y.get_cols() == get_output_count());
+        assert(batch_size > 0);
+        const auto max_rows = std::min(batch_size, X.get_rows());
+        const auto n_threads = pool.get_thread_count();
+        const auto shard_size = deterministic ? deterministic_shard_size
+                                              : (max_rows + n_threads - 1) / n_threads;
+        const auto max_shards = (max_rows + shard_size - 1) / shard_size;
+        const auto n_buffers = deterministic ? std::min(max_shards, deterministic_max_buffers) : max_shards;
+        std::vector<State> states(n_threads);
+        // the last buffer holds the total of the waves if a batch needs several
+        std::vector<std::vector<float>> gradients(n_buffers + (max_shards > n_buffers),
+                                                  std::vector<float>(weights_.size()));
+        std::vector<float> losses(max_shards);
+        float loss = 0;
+        for (std::size_t begin = 0; begin < X.get_rows(); begin += batch_size)
+        {
+            const auto n_rows = std::min(batch_size, X.get_rows() - begin);
+            const auto n_shards = (n_rows + shard_size - 1) / shard_size;
+            for (std::size_t first = 0; first < n_shards; first += n_buffers)
+            {
+                const auto n_wave = std::min(n_buffers, n_shards - first);
+                pool.parallel_for(n_wave, [&](const std::size_t buffer, const std::size_t thread_index)
+                {
+                    State& state = states[thread_index];
+                    reserve(state, shard_size);
+                    const auto shard = first + buffer;
+                    const auto shard_begin = begin + shard * shard_size;
+                    const auto shard_rows = std::min(shard_size, begin + n_rows - shard_begin);
+                    losses[shard] = compute_gradients(state, X.get_row_range(shard_begin, shard_rows),
+                                                      y.get_row_range(shard_begin, shard_rows),
+                                                      gradients[buffer].data());
+                });
+                reduce(gradients, n_wave, pool);
+                if (first == 0 && n_shards > n_buffers)
+                {
+                    std::swap(gradients.front(), gradients.back());
+                }
+                else if (first > 0)
+                {
+                    kernels::axpy(1.0f, gradients.front().data(), gradients.back().data(), weights_.size());
+                }
+            }
+            for (std::size_t shard = 0; shard < n_shards; ++shard)
+            {
+                loss += losses[shard];
+            }
+            apply_gradients((n_shards > n_buffers ? gradients.back() : gradients.front()).data(), n_rows, learning_rate);
+        }
+        topology_->get_loss().transform_error(loss);
+        return loss;
+    }
+
+    float train(const std::vector<std::vector<float>>& X,
+                const std::vector<std::vector<float>>& y,
+                const float learning_rate,
+                const std::size_t batch_size,
+                ThreadPool& pool,
+                const bool deterministic = false)
     {
-        std::vector<float> output = input;
-        for (const Layer& layer : layers_)
+        return train(to_matrix(X), to_matrix(y), learning_rate, batch_size, pool, deterministic);
+    }
+
+    // Asynchronous per-sample SGD in the style of Hogwild. Every thread of the
+    // pool runs the per-sample loop over its own contiguous slice of the
+    // samples and updates the shared weights without any locking, so updates
+    // of different threads may overwrite each other. This is a deliberate
+    // data race which costs some accuracy on dense problems but lets the
+    // training scale with the number of threads. The result depends on the
+    // scheduling and is not reproducible.
+    float train_hogwild(const ConstMatrixView X,
+                        const ConstMatrixView y,
+                        const float learning_rate,
+                        ThreadPool& pool)
+    {
+        assert(X.get_rows() == y.get_rows());
+        assert(X.get_cols() == get_input_count());
+        assert(y.get_cols() == get_output_count());
+        const auto n_threads = pool.get_thread_count();
+        const auto slice_size = (X.get_rows() + n_threads - 1) / n_threads;
+        std::vector<State> states(n_threads);
+        std::vector<float> losses(n_threads);
+        pool.parallel_for(n_threads, [&](const std::size_t slice, const std::size_t thread_index)
         {
-            std::vector<float> new_input;
-            for (const Neuron& neuron : layer.neurons)
+            State& state = states[thread_index];
+            reserve(state, 1);
+            const auto end = std::min(X.get_rows(), (slice + 1) * slice_size);
+            for (auto i = slice * slice_size; i < end; ++i)
             {
-                new_input.push_back(neuron.predict(weights_, output, *layer.transfer));
+                forward(state, X.get_row(i));
+                losses[slice] += loss_multi_output(state, state.deltas.back().data(), y.get_row(i),
+                                                   state.outputs.back().data(), y.get_cols());
+                backward(state);
+                update(state, learning_rate);
             }
-            output = std::move(new_input);
+        });
+        float loss = 0;
+        for (const auto value : losses)
+        {
+            loss += value;
         }
-        loss_->transform_output(output.data(), output.size());
+        topology_->get_loss().transform_error(loss);
+        return loss;
+    }
+
+    float train_hogwild(const std::vector<std::vector<float>>& X,
+                        const std::vector<std::vector<float>>& y,
+                        const float learning_rate,
+                        ThreadPool& pool)
+    {
+        return train_hogwild(to_matrix(X), to_matrix(y), learning_rate, pool);
+    }
+
+    // Full-batch training with L-BFGS on the mean loss over all samples, only
+    // for the SE loss since the gradients are not those of the CE loss and
+    // the line search needs both to match. For small networks and datasets
+    // this converges in tens of iterations where SGD needs hundreds of
+    // epochs. Returns the loss summed over the samples at the final weights.
+    float train_lbfgs(const ConstMatrixView X,
+                      const ConstMatrixView y,
+                      const optimizer::LBFGSOptions& options = {})
+    {
+        assert(X.get_rows() == y.get_rows());
+        assert(dynamic_cast<const loss::SE*>(&topology_->get_loss()));
+        assert(X.get_rows() > 0);
+        const auto scale = 1.0f / static_cast<float>(X.get_rows());
+        std::vector<float> weights(weights_.begin(), weights_.end());
+        const auto loss = optimizer::lbfgs(weights, [&](const float* x, float* gradients)
+        {
+            std::copy(x, x + weights_.size(), weights_.begin());
+            auto loss = compute_full_gradients(X, y, gradients);
+            topology_->get_loss().transform_error(loss);
+            for (std::size_t i = 0; i < weights_.size(); ++i)
+            {
+                gradients[i] *= scale;
+            }
+            return loss * scale;
+        }, options);
+        std::copy(weights.begin(), weights.end(), weights_.begin());
+        return loss * static_cast<float>(X.get_rows());
+    }
+
+    float train_lbfgs(const std::vector<std::vector<float>>& X,
+                      const std::vector<std::vector<float>>& y,
+                      const optimizer::LBFGSOptions& options = {})
+    {
+        return train_lbfgs(to_matrix(X), to_matrix(y), options);
+    }
+
+    // Full-batch training with Levenberg-Marquardt, only for the SE loss. It
+    // solves a damped Gauss-Newton system over all weights per iteration, so
+    // it suits networks of up to a few thousand weights. Returns the loss
+    // summed over the samples at the final weights.
+    float train_levenberg_marquardt(const ConstMatrixView X,
+                                    const ConstMatrixView y,
+                                    const optimizer::LevenbergMarquardtOptions& options = {})
+    {
+        assert(X.get_rows() == y.get_rows());
+        assert(dynamic_cast<const loss::SE*>(&topology_->get_loss()));
+        std::vector<float> weights(weights_.begin(), weights_.end());
+        const auto loss = optimizer::levenberg_marquardt(weights, [&](const float* x, float* A, float* b)
+        {
+            std::copy(x, x + weights_.size(), weights_.begin());
+            return compute_normal_equations(X, y, A, b);
+        }, [&](const float* x)
+        {
+            std::copy(x, x + weights_.size(), weights_.begin());
+            return compute_squared_error(X, y);
+        }, options);
+        std::copy(weights.begin(), weights.end(), weights_.begin());
+        return loss;
+    }
+
+    float train_levenberg_marquardt(const std::vector<std::vector<float>>& X,
+                                    const std::vector<std::vector<float>>& y,
+                                    const optimizer::LevenbergMarquardtOptions& options = {})
+    {
+        return train_levenberg_marquardt(to_matrix(X), to_matrix(y), options);
+    }
+
+    std::vector<float> predict(const std::vector<float>& input) const
+    {
+        assert(input.size() == get_input_count());
+        Workspace workspace;
+        std::vector<float> output(get_output_count());
+        predict(input.data(), output.data(), workspace);
         return output;
     }
 
+    // Allocation-free inference. Reads get_layers().front() inputs and writes
+    // get_layers().back() outputs. The workspace is only allocated on first
+    // use, make_workspace() returns one that is already sized.
+    void predict(const float* input,
+                 float* output,
+                 Workspace& workspace) const
+    {
+        workspace.reserve(topology_->get_max_layer_size());
+        predict_tile(ConstMatrixView{input, 1, get_input_count()},
+                     MatrixView{output, 1, get_output_count()},
+                     workspace, nullptr);
+    }
+
+    // Scores the rows of X, one sample per row, and writes one row of
+    // get_layers().back() outputs per sample to out. The weights of every
+    // layer are packed once per call, then each layer runs as a
+    // matrix-matrix product over a tile of rows so that the activations of a
+    // tile stay in cache while it passes through all layers. Batches of
+    // fewer than pack_min_rows rows are not worth packing for and read the
+    // weights in place instead.
+    Matrix predict_batch(const ConstMatrixView X) const
+    {
+        Matrix out{X.get_rows(), get_output_count()};
+        predict_batch(X, out);
+        return out;
+    }
+
+    void predict_batch(const ConstMatrixView X,
+                       const MatrixView out) const
+    {
+        Workspace workspace;
+        predict_batch(X, out, workspace);
+    }
+
+    void predict_batch(const ConstMatrixView X,
+                       const MatrixView out,
+                       Workspace& workspace) const
+    {
+        assert(X.get_cols() == get_input_count());
+        assert(out.get_rows() == X.get_rows());
+        assert(out.get_cols() == get_output_count());
+        workspace.reserve(predict_tile_size * topology_->get_max_layer_size());
+        const float* packed = X.get_rows() < pack_min_rows ? nullptr : pack_weights(workspace);
+        for (std::size_t begin = 0; begin < X.get_rows(); begin += predict_tile_size)
+        {
+            const auto n_rows = std::min(predict_tile_size, X.get_rows() - begin);
+            predict_tile(X.get_row_range(begin, n_rows), out.get_row_range(begin, n_rows),
+                         workspace, packed);
+        }
+    }
+
+    // Scores the tiles of rows on the threads of the pool. Every tile is
+    // computed exactly as by the single-threaded predict_batch so the
+    // outputs do not depend on the thread count. Concurrent calls on a
+    // shared network are fine as long as each uses its own pool.
+    void predict_batch(const ConstMatrixView X,
+                       const MatrixView out,
+                       ThreadPool& pool) const
+    {
+        assert(X.get_cols() == get_input_count());
+        assert(out.get_rows() == X.get_rows());
+        assert(out.get_cols() == get_output_count());
+        std::vector<Workspace> workspaces(pool.get_thread_count());
+        const float* packed = X.get_rows() < pack_min_rows ? nullptr : pack_weights(workspaces.front());
+        const auto n_tiles = (X.get_rows() + predict_tile_size - 1) / predict_tile_size;
+        pool.parallel_for(n_tiles, [&](const std::size_t tile, const std::size_t thread_index)
+        {
+            Workspace& workspace = workspaces[thread_index];
+            workspace.reserve(predict_tile_size * topology_->get_max_layer_size());
+            const auto begin = tile * predict_tile_size;
+            const auto n_rows = std::min(predict_tile_size, X.get_rows() - begin);
+            predict_tile(X.get_row_range(begin, n_rows), out.get_row_range(begin, n_rows),
+                         workspace, packed);
+        });
+    }
+
+    // the same for rows x cols inputs stored row-major in X, writing rows x
+    // get_layers().back() outputs to out
+    void predict_batch(const float* X,
+                       const std::size_t rows,
+                       const std::size_t cols,
+                       float* out) const
+    {
+        predict_batch(ConstMatrixView{X, rows, cols},
+                      MatrixView{out, rows, get_output_count()});
+    }
+
+    void predict_batch(const float* X,
+                       const std::size_t rows,
+                       const std::size_t cols,
+                       float* out,
+                       Workspace& workspace) const
+    {
+        predict_batch(ConstMatrixView{X, rows, cols},
+                      MatrixView{out, rows, get_output_count()},
+                      workspace);
+    }
+
+    void predict_batch(const float* X,
+                       const std::size_t rows,
+                       const std::size_t cols,
+                       float* out,
+                       ThreadPool& pool) const
+    {
+        predict_batch(ConstMatrixView{X, rows, cols},
+                      MatrixView{out, rows, get_output_count()},
+                      pool);
+    }
+
+    Workspace make_workspace(const std::size_t batch_size = 1) const
+    {
+        return Workspace{std::min(batch_size, predict_tile_size) * topology_->get_max_layer_size()};
+    }
+
 private:
+    template<typename U>
+    friend class BasicNetwork;
 
-    struct Layer
+    using Layer = Topology::Layer;
+
+    // leaves the weights empty for the caller to set
+    explicit
+    BasicNetwork(std::shared_ptr<const Topology> topology)
+        : topology_{std::move(topology)}
+    {}
+
+    // The activation buffers of a training pass, they hold one row per
+    // sample of the current batch for every layer. Threads training at the
+    // same time each use their own state and share the weights.
+    struct State
     {
-        std::unique_ptr<transfer::Transfer> transfer;
-        std::vector<Neuron> neurons;
+        std::vector<float> input;
+        std::vector<std::vector<float>> outputs; // per layer
+        std::vector<std::vector<float>> deltas; // per layer
+        std::vector<float> transformed;
     };
 
-    template<typename T>
-    static void write(std::ostream& os, const T& value)
+    template<typename U>
+    static void write(std::ostream& os, const U& value)
+    {
+        os.write(reinterpret_cast<const char*>(&value), sizeof(U));
+    }
+
+    template<typename U>
+    static bool read(std::istream& is, U& value)
+    {
+        return static_cast<bool>(is.read(reinterpret_cast<char*>(&value), sizeof(U)));
+    }
+
+    // Throws std::runtime_error unless the header of the model called name
+    // can be read by this version.
+    static void check_header(const ModelHeader& header,
+                             const std::string& name)
+    {
+        if (std::memcmp(header.magic, magic, sizeof(magic)) != 0)
+        {
+            throw std::runtime_error{name + " is not a model"};
+        }
+        if (header.byte_order != byte_order)
+        {
+            throw std::runtime_error{name + " was written with another byte order"};
+        }
+        if (header.version != version
+            || header.data_type > DataType::Float16
+            || header.target_type > TargetType::Regression)
+        {
+            throw std::runtime_error{name + " has an unsupported version, data type or target type"};
+        }
+        if (header.layer_count < 2)
+        {
+            throw std::runtime_error{name + " is truncated or corrupt"};
+        }
+    }
+
+    // the header.layer_count uint64 layer sizes at layer_data, which must be
+    // positive and match the weight count
+    static std::vector<std::size_t> read_layers(const ModelHeader& header,
+                                                const char* layer_data,
+                                                const std::string& name)
+    {
+        std::vector<std::size_t> layers(static_cast<std::size_t>(header.layer_count));
+        for (std::size_t i = 0; i < layers.size(); ++i)
+        {
+            std::uint64_t value;
+            std::memcpy(&value, layer_data + i * sizeof(value), sizeof(value));
+            layers[i] = static_cast<std::size_t>(value);
+        }
+        if (std::count(layers.begin(), layers.end(), std::size_t{0}) > 0
+            || Topology::count_weights(layers) != header.weight_count)
+        {
+            throw std::runtime_error{name + " is truncated or corrupt"};
+        }
+        return layers;
+    }
+
+    // the checksum of a model with the given header, layer sizes and weights
+    static std::uint64_t compute_checksum(ModelHeader header,
+                                          const char* layer_data,
+                                          const char* bytes)
     {
-        os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+        header.checksum = 0;
+        auto hash = detail::checksum(reinterpret_cast<const char*>(&header), sizeof(header));
+        hash = detail::checksum(layer_data, header.layer_count * sizeof(std::uint64_t), hash);
+        return detail::checksum(bytes, header.weight_count * get_size(header.data_type), hash);
     }
 
-    template<typename T>
-    static void read(std::istream& is, T& value)
+    // the n values stored as data_type at bytes converted to T
+    static std::vector<T> convert_values(const DataType data_type,
+                                         const char* bytes,
+                                         const std::size_t n)
     {
-        is.read(reinterpret_cast<char*>(&value), sizeof(T));
+        std::vector<float> values(n);
+        switch (data_type)
+        {
+            case DataType::Float32: read_values<float>(bytes, values); break;
+            case DataType::BFloat16: read_values<bfloat16>(bytes, values); break;
+            case DataType::Float16: read_values<float16>(bytes, values); break;
+        }
+        std::vector<T> weights(n);
+        gmlp::convert(values.data(), weights.data(), weights.size());
+        return weights;
     }
 
-    void add_neuron(Layer& layer,
-                    init::RandomEngine& random_engine,
-                    const std::size_t n_inputs)
+    // Reads the stream format of earlier versions: the target type, the
+    // layer count, the layer sizes, the weight count and the float weights.
+    static BasicNetwork load_unversioned(std::istream& is)
     {
-        layer.neurons.emplace_back(weights_.size());
-        const auto weight_count = n_inputs + 1; // weights + bias
-        weights_.resize(weights_.size() + weight_count);
-        init::xavier(random_engine, weights_.data() + weights_.size() - weight_count, weight_count);
+        std::uint8_t target_type;
+        std::uint64_t layer_count;
+        if (!read(is, target_type) || !read(is, layer_count))
+        {
+            throw std::runtime_error{"the stream is not a model"};
+        }
+        if (target_type > TargetType::Regression || layer_count < 2)
+        {
+            throw std::runtime_error{"the stream is not a model"};
+        }
+        std::vector<std::size_t> layers;
+        std::uint64_t value;
+        while (layers.size() < layer_count && read(is, value))
+        {
+            layers.push_back(static_cast<std::size_t>(value));
+        }
+        std::uint64_t weight_count;
+        if (!is || !read(is, weight_count)
+            || std::count(layers.begin(), layers.end(), std::size_t{0}) > 0
+            || Topology::count_weights(layers) != weight_count)
+        {
+            throw std::runtime_error{"the stream is truncated or corrupt"};
+        }
+        std::vector<T> weights(static_cast<std::size_t>(weight_count));
+        for (auto& weight : weights)
+        {
+            float stored;
+            if (!read(is, stored))
+            {
+                throw std::runtime_error{"the stream is truncated"};
+            }
+            weight = T(stored);
+        }
+        BasicNetwork net{std::make_shared<const Topology>(static_cast<TargetType>(target_type), layers)};
+        net.weights_ = WeightBuffer<T>{std::move(weights)};
+        return net;
     }
 
-    std::vector<float> forward(const std::vector<float>& input)
+    // reads values stored as U from memory
+    template<typename U>
+    static void read_values(const char* bytes,
+                            std::vector<float>& values)
     {
-        std::vector<float> output = input;
-        for (Layer& layer : layers_)
+        std::vector<U> stored(values.size());
+        std::memcpy(stored.data(), bytes, stored.size() * sizeof(U));
+        gmlp::convert(stored.data(), values.data(), values.size());
+    }
+
+    // number of values which reduce adds up per task
+    static constexpr std::size_t reduce_chunk_size = 4096;
+
+    // number of rows which the full-batch training evaluates at once
+    static constexpr std::size_t full_batch_chunk_size = 256;
+
+    // packs the weights of all layers for kernels::gemm_packed
+    const float* pack_weights(Workspace& workspace) const
+    {
+        float* packed = workspace.get_packed_weights(topology_->get_packed_size());
+        topology_->pack(weights_.data(), packed);
+        return packed;
+    }
+
+    // packed are the weights packed by pack_weights or null
+    void predict_tile(const ConstMatrixView X,
+                      const MatrixView out,
+                      Workspace& workspace,
+                      const float* packed) const
+    {
+        topology_->predict_tile(weights_.data(), packed, X, out,
+                                {workspace.get_buffer(0), workspace.get_buffer(1)}, precision_);
+    }
+
+    const float* get_inputs(const State& state,
+                            const std::size_t layer_index) const
+    {
+        return layer_index == 0 ? state.input.data() : state.outputs[layer_index - 1].data();
+    }
+
+    void reserve(State& state,
+                 const std::size_t batch_size) const
+    {
+        const auto& layers = topology_->get_layers();
+        const auto grow = [](std::vector<float>& buffer, const std::size_t size)
+        {
+            buffer.resize(std::max(buffer.size(), size));
+        };
+        grow(state.input, batch_size * get_input_count());
+        state.outputs.resize(layers.size());
+        state.deltas.resize(layers.size());
+        for (std::size_t i = 0; i < layers.size(); ++i)
+        {
+            grow(state.outputs[i], batch_size * layers[i].neurons.size());
+            grow(state.deltas[i], batch_size * layers[i].neurons.size());
+        }
+    }
+
+    void forward(State& state,
+                 const float* input) const
+    {
+        const auto& layers = topology_->get_layers();
+        static_assert(std::is_same<T, float>::value, "only float networks can be trained");
+        std::copy(input, input + get_input_count(), state.input.begin());
+        for (std::size_t i = 0; i < layers.size(); ++i)
         {
-            std::vector<float> new_input;
-            for (Neuron& neuron : layer.neurons)
+            const Layer& layer = layers[i];
+            const float* inputs = get_inputs(state, i);
+            float* outputs = state.outputs[i].data();
+            for (std::size_t j = 0; j < layer.neurons.size(); ++j)
             {
-                new_input.push_back(neuron.forward(weights_, output, *layer.transfer));
+                outputs[j] = layer.neurons[j].predict(weights_.data(), inputs, layer.n_inputs);
             }
-            output = std::move(new_input);
+            layer.transfer->apply(outputs, layer.neurons.size(), precision_);
         }
-        return output;
     }
 
-    void backward(std::vector<float> deltas)
+    // expects the deltas of the output layer to be set by the loss
+    void backward(State& state) const
     {
-        for (std::size_t i = layers_.size(); i--;)
+        const auto& layers = topology_->get_layers();
+        for (std::size_t i = layers.size(); i--;)
         {
-            Layer& layer = layers_[i];
-            if (i + 1 < layers_.size())
+            const Layer& layer = layers[i];
+            float* deltas = state.deltas[i].data();
+            if (i + 1 < layers.size())
             {
-                deltas.clear();
-                for (std::size_t j = 0; j < layer.neurons.size(); ++j)
+                const Layer& next_layer = layers[i + 1];
+                const float* next_deltas = state.deltas[i + 1].data();
+                std::fill(deltas, deltas + layer.neurons.size(), 0.0f);
+                for (std::size_t k = 0; k < next_layer.neurons.size(); ++k)
                 {
-                    float delta = 0;
-                    for (Neuron& neuron : layers_[i + 1].neurons)
-                    {
-                        delta += neuron.get_delta(weights_, j);
-                    }
-                    deltas.push_back(delta);
+                    next_layer.neurons[k].backpropagate(weights_.data(), next_deltas[k],
+                                                        deltas, next_layer.n_inputs);
                 }
             }
+            layer.transfer->apply_deriv(state.outputs[i].data(), deltas, layer.neurons.size());
+        }
+    }
+
+    void update(const State& state,
+                const float learning_rate)
+    {
+        const auto& layers = topology_->get_layers();
+        for (std::size_t i = 0; i < layers.size(); ++i)
+        {
+            const Layer& layer = layers[i];
+            const float* inputs = get_inputs(state, i);
             for (std::size_t j = 0; j < layer.neurons.size(); ++j)
             {
-                Neuron& neuron = layer.neurons[j];
-                neuron.backward(deltas[j], *layer.transfer);
+                layer.neurons[j].update(weights_.data(), inputs, layer.n_inputs,
+                                        state.deltas[i][j], learning_rate);
             }
         }
     }
 
-    void update(const float learning_rate)
+    void forward_batch(State& state,
+                       const std::size_t n_rows) const
     {
-        for (Layer& layer : layers_)
+        const auto& layers = topology_->get_layers();
+        static_assert(std::is_same<T, float>::value, "only float networks can be trained");
+        for (std::size_t i = 0; i < layers.size(); ++i)
         {
-            for (Neuron& neuron : layer.neurons)
+            const Layer& layer = layers[i];
+            const auto n_outputs = layer.neurons.size();
+            const auto stride = layer.get_weight_stride();
+            const float* W = weights_.data() + layer.get_weight_offset();
+            float* outputs = state.outputs[i].data();
+            kernels::gemm_nt(n_rows, n_outputs, layer.n_inputs,
+                             get_inputs(state, i), layer.n_inputs,
+                             W, stride,
+                             outputs, n_outputs);
+            for (std::size_t r = 0; r < n_rows; ++r)
             {
-                neuron.update(weights_, learning_rate);
+                for (std::size_t j = 0; j < n_outputs; ++j)
+                {
+                    outputs[r * n_outputs + j] += W[j * stride + layer.n_inputs]; // bias
+                }
             }
+            layer.transfer->apply(outputs, n_rows * n_outputs, precision_);
         }
     }
 
-    float loss_multi_output(std::vector<float>& deltas,
-                            const std::vector<float>& truth,
-                            const std::vector<float>& pred)
+    // expects the deltas of the output layer to be set by the loss
+    void backward_batch(State& state,
+                        const std::size_t n_rows) const
     {
-        assert(pred.size() == truth.size());
-        auto transformed_pred = pred;
-        loss_->transform_output(transformed_pred.data(), transformed_pred.size());
+        const auto& layers = topology_->get_layers();
+        for (std::size_t i = layers.size(); i--;)
+        {
+            const Layer& layer = layers[i];
+            const auto n_outputs = layer.neurons.size();
+            float* deltas = state.deltas[i].data();
+            if (i + 1 < layers.size())
+            {
+                const Layer& next_layer = layers[i + 1];
+                kernels::gemm_nn(n_rows, n_outputs, next_layer.neurons.size(),
+                                 state.deltas[i + 1].data(), next_layer.neurons.size(),
+                                 weights_.data() + next_layer.get_weight_offset(),
+                                 next_layer.get_weight_stride(),
+                                 deltas, n_outputs);
+            }
+            layer.transfer->apply_deriv(state.outputs[i].data(), deltas, n_rows * n_outputs);
+        }
+    }
+
+    // per-sample SGD, returns the loss summed over the samples
+    float train_samples(const ConstMatrixView X,
+                        const ConstMatrixView y,
+                        const float learning_rate)
+    {
+        if (optimizer_)
+        {
+            return train_batches(X, y, learning_rate, 1);
+        }
+        assert(X.get_rows() == y.get_rows());
+        assert(X.get_cols() == get_input_count());
+        assert(y.get_cols() == get_output_count());
+        reserve(state_, 1);
         float loss = 0;
-        for (std::size_t i = 0; i < truth.size(); ++i)
+        for (std::size_t i = 0; i < X.get_rows(); ++i)
         {
-            loss += loss_->call(truth[i], transformed_pred[i]);
-            deltas.push_back(loss_->call_deriv(truth[i], pred[i]));
+            forward(state_, X.get_row(i));
+            loss += loss_multi_output(state_, state_.deltas.back().data(), y.get_row(i),
+                                      state_.outputs.back().data(), y.get_cols());
+            backward(state_);
+            update(state_, learning_rate);
         }
         return loss;
     }
 
-    TargetType target_type_;
-    std::unique_ptr<loss::Loss> loss_;
-    std::vector<Layer> layers_;
-    std::vector<float> weights_;
+    // mini-batch gradient descent, returns the loss summed over the samples
+    float train_batches(const ConstMatrixView X,
+                        const ConstMatrixView y,
+                        const float learning_rate,
+                        const std::size_t batch_size)
+    {
+        assert(X.get_rows() == y.get_rows());
+        assert(X.get_cols() == get_input_count());
+        assert(y.get_cols() == get_output_count());
+        assert(batch_size > 0);
+        reserve(state_, std::min(batch_size, X.get_rows()));
+        gradients_.resize(weights_.size());
+        float loss = 0;
+        for (std::size_t begin = 0; begin < X.get_rows(); begin += batch_size)
+        {
+            const auto n_rows = std::min(batch_size, X.get_rows() - begin);
+            loss += compute_gradients(state_, X.get_row_range(begin, n_rows),
+                                      y.get_row_range(begin, n_rows), gradients_.data());
+            apply_gradients(gradients_.data(), n_rows, learning_rate);
+        }
+        return loss;
+    }
+
+    // applies gradients summed over n_rows samples with the optimizer
+    void apply_gradients(const float* gradients,
+                         const std::size_t n_rows,
+                         const float learning_rate)
+    {
+        static_assert(std::is_same<T, float>::value, "only float networks can be trained");
+        const auto gradient_scale = 1.0f / static_cast<float>(n_rows);
+        if (optimizer_)
+        {
+            optimizer_->step(weights_.data(), gradients, weights_.size(), learning_rate, gradient_scale);
+        }
+        else
+        {
+            kernels::axpy(-learning_rate * gradient_scale, gradients, weights_.data(), weights_.size()); // SGD
+        }
+    }
+
+    // Runs the samples of X through the network and writes the gradients
+    // summed over the rows to gradients, which has the layout of weights_.
+    // Returns the summed loss of the rows.
+    float compute_gradients(State& state,
+                            const ConstMatrixView X,
+                            const ConstMatrixView y,
+                            float* gradients) const
+    {
+        const auto& layers = topology_->get_layers();
+        const auto n_rows = X.get_rows();
+        load_inputs(state, X);
+        forward_batch(state, n_rows);
+        const auto n_outputs = get_output_count();
+        float loss = 0;
+        for (std::size_t r = 0; r < n_rows; ++r)
+        {
+            loss += loss_multi_output(state,
+                                      state.deltas.back().data() + r * n_outputs,
+                                      y.get_row(r),
+                                      state.outputs.back().data() + r * n_outputs,
+                                      n_outputs);
+        }
+        backward_batch(state, n_rows);
+
+        std::fill(gradients, gradients + weights_.size(), 0.0f);
+        for (std::size_t i = 0; i < layers.size(); ++i)
+        {
+            const Layer& layer = layers[i];
+            const auto n_layer_outputs = layer.neurons.size();
+            const auto stride = layer.get_weight_stride();
+            const float* deltas = state.deltas[i].data();
+            float* G = gradients + layer.get_weight_offset();
+            kernels::gemm_tn(n_layer_outputs, layer.n_inputs, n_rows,
+                             deltas, n_layer_outputs,
+                             get_inputs(state, i), layer.n_inputs,
+                             G, stride);
+            for (std::size_t r = 0; r < n_rows; ++r)
+            {
+                for (std::size_t j = 0; j < n_layer_outputs; ++j)
+                {
+                    G[j * stride + layer.n_inputs] += deltas[r * n_layer_outputs + j]; // bias
+                }
+            }
+        }
+        return loss;
+    }
+
+    // Loss and gradients summed over all samples, evaluated in chunks of
+    // full_batch_chunk_size rows.
+    float compute_full_gradients(const ConstMatrixView X,
+                                 const ConstMatrixView y,
+                                 float* gradients)
+    {
+        reserve(state_, std::min(full_batch_chunk_size, X.get_rows()));
+        gradients_.resize(weights_.size());
+        std::fill(gradients, gradients + weights_.size(), 0.0f);
+        float loss = 0;
+        for (std::size_t begin = 0; begin < X.get_rows(); begin += full_batch_chunk_size)
+        {
+            const auto n_rows = std::min(full_batch_chunk_size, X.get_rows() - begin);
+            loss += compute_gradients(state_, X.get_row_range(begin, n_rows),
+                                      y.get_row_range(begin, n_rows), gradients_.data());
+            kernels::axpy(1.0f, gradients_.data(), gradients, weights_.size());
+        }
+        return loss;
+    }
+
+    // 0.5 * the squared error summed over all samples
+    float compute_squared_error(const ConstMatrixView X,
+                                const ConstMatrixView y)
+    {
+        reserve(state_, std::min(full_batch_chunk_size, X.get_rows()));
+        const auto n_outputs = get_output_count();
+        float error = 0;
+        for (std::size_t begin = 0; begin < X.get_rows(); begin += full_batch_chunk_size)
+        {
+            const auto n_rows = std::min(full_batch_chunk_size, X.get_rows() - begin);
+            load_inputs(state_, X.get_row_range(begin, n_rows));
+            forward_batch(state_, n_rows);
+            for (std::size_t r = 0; r < n_rows; ++r)
+            {
+                for (std::size_t k = 0; k < n_outputs; ++k)
+                {
+                    const auto residual = state_.outputs.back()[r * n_outputs + k] - y(begin + r, k);
+                    error += residual * residual;
+                }
+            }
+        }
+        return 0.5f * error;
+    }
+
+    // Writes the Gauss-Newton normal equations A = J^T * J and b = J^T * r
+    // of the residuals r = pred - truth over all samples and outputs, with
+    // J their Jacobian by the weights. Each output of a chunk is
+    // backpropagated separately to get the Jacobian rows of the chunk.
+    // Returns 0.5 * |r|^2.
+    float compute_normal_equations(const ConstMatrixView X,
+                                   const ConstMatrixView y,
+                                   float* A,
+                                   float* b)
+    {
+        const auto& layers = topology_->get_layers();
+        const auto n_weights = weights_.size();
+        const auto n_outputs = get_output_count();
+        const auto chunk_rows = std::min(full_batch_chunk_size, X.get_rows());
+        reserve(state_, chunk_rows);
+        std::fill(A, A + n_weights * n_weights, 0.0f);
+        std::fill(b, b + n_weights, 0.0f);
+        std::vector<float> J(chunk_rows * n_weights);
+        std::vector<float> JtJ(n_weights * n_weights);
+        std::vector<float> residuals(chunk_rows * n_outputs);
+        float error = 0;
+        for (std::size_t begin = 0; begin < X.get_rows(); begin += full_batch_chunk_size)
+        {
+            const auto n_rows = std::min(full_batch_chunk_size, X.get_rows() - begin);
+            load_inputs(state_, X.get_row_range(begin, n_rows));
+            forward_batch(state_, n_rows);
+            for (std::size_t r = 0; r < n_rows; ++r)
+            {
+                for (std::size_t k = 0; k < n_outputs; ++k)
+                {
+                    residuals[r * n_outputs + k] = state_.outputs.back()[r * n_outputs + k] - y(begin + r, k);
+                    error += residuals[r * n_outputs + k] * residuals[r * n_outputs + k];
+                }
+            }
+            for (std::size_t k = 0; k < n_outputs; ++k)
+            {
+                float* output_deltas = state_.deltas.back().data();
+                std::fill(output_deltas, output_deltas + n_rows * n_outputs, 0.0f);
+                for (std::size_t r = 0; r < n_rows; ++r)
+                {
+                    output_deltas[r * n_outputs + k] = 1;
+                }
+                backward_batch(state_, n_rows);
+                for (std::size_t i = 0; i < layers.size(); ++i)
+                {
+                    const Layer& layer = layers[i];
+                    const auto n_layer_outputs = layer.neurons.size();
+                    const auto stride = layer.get_weight_stride();
+                    const float* deltas = state_.deltas[i].data();
+                    const float* inputs = get_inputs(state_, i);
+                    for (std::size_t r = 0; r < n_rows; ++r)
+                    {
+                        const float* row_inputs = inputs + r * layer.n_inputs;
+                        float* row = J.data() + r * n_weights + layer.get_weight_offset();
+                        for (std::size_t j = 0; j < n_layer_outputs; ++j)
+                        {
+                            const auto delta = deltas[r * n_layer_outputs + j];
+                            for (std::size_t c = 0; c < layer.n_inputs; ++c)
+                            {
+                                row[j * stride + c] = delta * row_inputs[c];
+                            }
+                            row[j * stride + layer.n_inputs] = delta; // bias
+                        }
+                    }
+                }
+                kernels::gemm_tn(n_weights, n_weights, n_rows, J.data(), n_weights, J.data(), n_weights,
+                                 JtJ.data(), n_weights);
+                kernels::axpy(1.0f, JtJ.data(), A, JtJ.size());
+                for (std::size_t r = 0; r < n_rows; ++r)
+                {
+                    kernels::axpy(residuals[r * n_outputs + k], J.data() + r * n_weights, b, n_weights);
+                }
+            }
+        }
+        return 0.5f * error;
+    }
+
+    void load_inputs(State& state,
+                     const ConstMatrixView X) const
+    {
+        const auto n_rows = X.get_rows();
+        const auto n_inputs = get_input_count();
+        if (X.is_contiguous())
+        {
+            std::copy(X.get_data(), X.get_data() + n_rows * n_inputs, state.input.begin());
+        }
+        else
+        {
+            for (std::size_t r = 0; r < n_rows; ++r)
+            {
+                std::copy(X.get_row(r), X.get_row(r) + n_inputs,
+                          state.input.begin() + static_cast<std::ptrdiff_t>(r * n_inputs));
+            }
+        }
+    }
+
+    // Adds up the first n buffers into the first one in pairs, buffer
+    // i + stride into buffer i for stride = 1, 2, 4, ... The order of the
+    // additions only depends on n. The pairs of one level are split into
+    // chunks and summed on the pool.
+    static void reduce(std::vector<std::vector<float>>& buffers,
+                       const std::size_t n,
+                       ThreadPool& pool)
+    {
+        const auto size = buffers.front().size();
+        const auto n_chunks = (size + reduce_chunk_size - 1) / reduce_chunk_size;
+        for (std::size_t stride = 1; stride < n; stride *= 2)
+        {
+            const auto n_pairs = (n - stride + 2 * stride - 1) / (2 * stride);
+            pool.parallel_for(n_pairs * n_chunks, [&](const std::size_t task, std::size_t)
+            {
+                const auto i = task / n_chunks * 2 * stride;
+                const auto offset = task % n_chunks * reduce_chunk_size;
+                kernels::axpy(1.0f, buffers[i + stride].data() + offset, buffers[i].data() + offset,
+                              std::min(reduce_chunk_size, size - offset));
+            });
+        }
+    }
+
+    float loss_multi_output(State& state,
+                            float* deltas,
+                            const float* truth,
+                            const float* pred,
+                            const std::size_t n) const
+    {
+        state.transformed.assign(pred, pred + n);
+        topology_->get_loss().transform_output(state.transformed.data(), n);
+        float loss = 0;
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            loss += topology_->get_loss().call(truth[i], state.transformed[i]);
+            deltas[i] = topology_->get_loss().call_deriv(truth[i], pred[i]);
+        }
+        return loss;
+    }
+
+    std::shared_ptr<const Topology> topology_;
+    transfer::Precision precision_ = transfer::Precision::Exact;
+    std::unique_ptr<optimizer::Optimizer> optimizer_;
+    WeightBuffer<T> weights_;
+    State state_;
+    std::vector<float> gradients_;
 };
 
+using Network = BasicNetwork<float>;
+
 }
@@ -7,11 +7,15 @@
 #include <vector>
 
 #include "init.h"
+#include "kernels.h"
 #include "transfer.h"
 
 namespace gmlp
 {
 
+// A neuron is a single row of its layer's weight matrix: n_inputs weights
+// followed by the bias. It does not hold any activation state, the layer owns
+// the input, output and delta buffers shared by all of its neurons.
 class Neuron
 {
 public:
@@ -21,65 +25,46 @@ public:
         : weight_offset_{weight_offset}
     {}
 
-    float get_delta(const std::vector<float>& weights,
-                    const std::size_t index) const
+    std::size_t get_weight_offset() const
     {
-        return weights[weight_offset_ + index] * data_.back();
+        return weight_offset_;
     }
 
-    float predict(const std::vector<float>& weights,
-                  const std::vector<float>& inputs,
-                  const transfer::Transfer& transfer) const
+    // returns the weighted sum of the inputs, the transfer is applied by the
+    // layer to all of its outputs at once
+    float predict(const float* weights,
+                  const float* inputs,
+                  const std::size_t n_inputs) const
     {
-        float output = 0.0f;
-        for (std::size_t i = 0; i < inputs.size(); ++i)
-        {
-            output += weights[weight_offset_ + i] * inputs[i];
-        }
-        output += weights[weight_offset_ + inputs.size()]; // bias
-        output = transfer.call(output);
+        const float* row = weights + weight_offset_;
+        float output = kernels::dot(row, inputs, n_inputs);
+        output += row[n_inputs]; // bias
         return output;
     }
 
-    float forward(const std::vector<float>& weights,
-                  const std::vector<float>& inputs,
-                  const transfer::Transfer& transfer)
+    // accumulates this neuron's delta into the deltas of the previous layer
+    void backpropagate(const float* weights,
+                       const float delta,
+                       float* deltas,
+                       const std::size_t n_inputs) const
     {
-        const auto output = predict(weights, inputs, transfer);
-        if (data_.empty())
-        {
-            data_.resize(inputs.size() + input_offset_);
-        }
-        std::copy(inputs.begin(), inputs.end(), data_.begin());
-        data_[inputs.size()] = output;
-        return output;
-    }
-
-    void backward(const float delta,
-                  const transfer::Transfer& transfer)
-    {
-        const auto n_inputs = data_.size() - input_offset_;
-        data_.back() = transfer.call_deriv(data_[n_inputs]) * delta;
+        kernels::axpy(delta, weights + weight_offset_, deltas, n_inputs);
     }
 
-    void update(std::vector<float>& weights,
-                const float learning_rate)
+    void update(float* weights,
+                const float* inputs,
+                const std::size_t n_inputs,
+                const float delta,
+                const float learning_rate) const
     {
-        const auto n_inputs = data_.size() - input_offset_;
-        const auto update = -learning_rate * data_.back(); // SGD
-        for (std::size_t i = 0; i < n_inputs; ++i)
-        {
-            weights[weight_offset_ + i] += update * data_[i];
-        }
-        weights[weight_offset_ + n_inputs] += update; // bias
+        float* row = weights + weight_offset_;
+        const auto update = -learning_rate * delta; // SGD
+        kernels::axpy(update, inputs, row, n_inputs);
+        row[n_inputs] += update; // bias
     }
 
 private:
-    // data_ contains neuron inputs except for the last input_offset_ which
-    // are 'output' and 'delta' (for cache friendlyness)
-    static constexpr std::size_t input_offset_ = 2;
     std::size_t weight_offset_;
-    std::vector<float> data_;
 };
 
 }
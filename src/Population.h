@@ -0,0 +1,229 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "init.h"
+#include "Matrix.h"
+#include "Network.h"
+#include "ThreadPool.h"
+#include "Topology.h"
+
+namespace gmlp
+{
+
+// The genomes of a population of networks which share one topology, stored
+// as one contiguous matrix with one row of weights per individual. This lets
+// evaluate score the whole population in one pass over the data, reusing
+// every tile of rows for many individuals while it is in cache.
+class Population
+{
+public:
+    explicit
+    Population(std::shared_ptr<const Topology> topology,
+               const transfer::Precision precision = transfer::Precision::Exact)
+        : topology_{std::move(topology)}, precision_{precision}
+    {}
+
+    // n_individuals genomes initialized exactly like n_individuals networks
+    // constructed one after another from random_engine
+    Population(std::shared_ptr<const Topology> topology,
+               const std::size_t n_individuals,
+               init::RandomEngine& random_engine,
+               const transfer::Precision precision = transfer::Precision::Exact)
+        : Population{std::move(topology), precision}
+    {
+        genomes_.resize(n_individuals * get_weight_count());
+        for (std::size_t i = 0; i < n_individuals; ++i)
+        {
+            topology_->initialize(random_engine, get_genome(i));
+        }
+    }
+
+    // n_individuals genomes initialized in parallel from the counter-based
+    // generator, the same for any thread count
+    Population(std::shared_ptr<const Topology> topology,
+               const std::size_t n_individuals,
+               const init::Philox& philox,
+               ThreadPool& pool,
+               const transfer::Precision precision = transfer::Precision::Exact)
+        : Population{std::move(topology), precision}
+    {
+        genomes_.resize(n_individuals * get_weight_count());
+        pool.parallel_for(n_individuals, [&](const std::size_t individual, std::size_t)
+        {
+            topology_->initialize(philox, individual, get_genome(individual));
+        });
+    }
+
+    std::size_t size() const
+    {
+        return genomes_.size() / get_weight_count();
+    }
+
+    const std::shared_ptr<const Topology>& get_topology() const
+    {
+        return topology_;
+    }
+
+    transfer::Precision get_precision() const
+    {
+        return precision_;
+    }
+
+    std::size_t get_weight_count() const
+    {
+        return topology_->get_weight_count();
+    }
+
+    const float* get_genome(const std::size_t individual) const
+    {
+        assert(individual < size());
+        return genomes_.data() + individual * get_weight_count();
+    }
+
+    float* get_genome(const std::size_t individual)
+    {
+        assert(individual < size());
+        return genomes_.data() + individual * get_weight_count();
+    }
+
+    // appends a copy of the get_weight_count() weights and returns its index
+    std::size_t add(const float* genome)
+    {
+        genomes_.insert(genomes_.end(), genome, genome + get_weight_count());
+        return size() - 1;
+    }
+
+    // appends a copy of an individual and returns the index of the copy
+    std::size_t duplicate(const std::size_t individual)
+    {
+        assert(individual < size());
+        const auto n_weights = get_weight_count();
+        const auto copy = size();
+        genomes_.resize(genomes_.size() + n_weights);
+        std::copy_n(get_genome(individual), n_weights, get_genome(copy));
+        return copy;
+    }
+
+    // keeps only the given individuals in the given order
+    void select(const std::vector<std::size_t>& individuals)
+    {
+        const auto n_weights = get_weight_count();
+        std::vector<float, AlignedAllocator<float>> selected(individuals.size() * n_weights);
+        for (std::size_t i = 0; i < individuals.size(); ++i)
+        {
+            const float* genome = get_genome(individuals[i]);
+            std::copy(genome, genome + n_weights, selected.data() + i * n_weights);
+        }
+        genomes_ = std::move(selected);
+    }
+
+    // a network with a copy of the weights of the individual
+    Network get_network(const std::size_t individual) const
+    {
+        const float* genome = get_genome(individual);
+        Network net{topology_, std::vector<float>(genome, genome + get_weight_count())};
+        net.set_precision(precision_);
+        return net;
+    }
+
+    // Returns the mean absolute error of every individual on X and y, equal
+    // to mae() of the predictions of get_network(i). The rows of X are
+    // scored in tiles which each thread of the pool multiplies with the
+    // weights of its share of the individuals before it moves to the next
+    // tile, so the dataset is read once per thread rather than once per
+    // individual. Each tile goes through Topology::predict_tile like in
+    // predict_batch. For batches of at least Network::pack_min_rows rows the
+    // weights of every individual are packed first, which takes about as
+    // much memory again as the genomes. The result does not depend on the
+    // thread count.
+    std::vector<float> evaluate(const ConstMatrixView X,
+                                const ConstMatrixView y,
+                                ThreadPool& pool) const
+    {
+        const auto& layers = topology_->get_layers();
+        assert(X.get_rows() == y.get_rows());
+        assert(X.get_rows() > 0);
+        assert(X.get_cols() == layers.front().n_inputs);
+        assert(y.get_cols() == layers.back().neurons.size());
+        const auto n_individuals = size();
+        std::vector<float> losses(n_individuals);
+        if (n_individuals == 0)
+        {
+            return losses;
+        }
+
+        // the same packing threshold as Network::predict_batch
+        const auto packed_stride = X.get_rows() >= Network::pack_min_rows ? topology_->get_packed_size() : 0;
+        std::vector<float, AlignedAllocator<float>> packed(n_individuals * packed_stride);
+        if (packed_stride > 0)
+        {
+            pool.parallel_for(n_individuals, [&](const std::size_t individual, std::size_t)
+            {
+                topology_->pack(get_genome(individual), packed.data() + individual * packed_stride);
+            });
+        }
+
+        const auto buffer_size = Network::predict_tile_size * topology_->get_max_layer_size();
+        const auto n_outputs = layers.back().neurons.size();
+        const auto n_blocks = std::min(pool.get_thread_count(), n_individuals);
+        const auto block_size = (n_individuals + n_blocks - 1) / n_blocks;
+        pool.parallel_for(n_blocks, [&](const std::size_t block, std::size_t)
+        {
+            const auto begin = block * block_size;
+            const auto end = std::min(begin + block_size, n_individuals);
+            std::vector<float> buffers[2] = {std::vector<float>(buffer_size), std::vector<float>(buffer_size)};
+            std::vector<float> pred(Network::predict_tile_size * n_outputs);
+            for (std::size_t row = 0; row < X.get_rows(); row += Network::predict_tile_size)
+            {
+                const auto n_rows = std::min(Network::predict_tile_size, X.get_rows() - row);
+                const auto X_tile = X.get_row_range(row, n_rows);
+                for (auto individual = begin; individual < end; ++individual)
+                {
+                    const float* packed_weights = packed_stride > 0 ? packed.data() + individual * packed_stride
+                                                                    : nullptr;
+                    topology_->predict_tile(get_genome(individual), packed_weights, X_tile,
+                                            MatrixView{pred.data(), n_rows, n_outputs},
+                                            {buffers[0].data(), buffers[1].data()}, precision_);
+                    losses[individual] = add_errors(y.get_row_range(row, n_rows), pred.data(), losses[individual]);
+                }
+            }
+        });
+        for (auto& loss : losses)
+        {
+            loss /= static_cast<float>(X.get_rows());
+        }
+        return losses;
+    }
+
+private:
+    // adds the absolute errors of the rows to sum in the same order as mae()
+    static float add_errors(const ConstMatrixView truth,
+                            const float* pred,
+                            float sum)
+    {
+        const auto n_cols = truth.get_cols();
+        for (std::size_t i = 0; i < truth.get_rows(); ++i)
+        {
+            float sub = 0.0f;
+            for (std::size_t j = 0; j < n_cols; ++j)
+            {
+                sub += std::abs(truth(i, j) - pred[i * n_cols + j]);
+            }
+            sub /= static_cast<float>(n_cols);
+            sum += sub;
+        }
+        return sum;
+    }
+
+    std::shared_ptr<const Topology> topology_;
+    transfer::Precision precision_;
+    std::vector<float, AlignedAllocator<float>> genomes_;
+};
+
+}
@@ -0,0 +1,373 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "kernels.h"
+#include "Matrix.h"
+#include "Network.h"
+#include "ThreadPool.h"
+#include "Topology.h"
+#include "utils.h"
+
+namespace gmlp
+{
+
+// how many weights share one int8 scale
+enum class Granularity
+{
+    PerLayer,
+    PerNeuron,
+};
+
+// An inference-only copy of a trained network with 8-bit weights and
+// activations. The weights of each neuron or layer are quantized
+// symmetrically to [-127, 127]. The inputs of every layer are quantized
+// asymmetrically to [0, 255] with a scale and zero point taken from the range
+// they span on a calibration dataset, so that dataset should be
+// representative of the data to score. The dot products accumulate exactly
+// in int32, then a single multiply-add per output dequantizes them and folds
+// in the bias before the transfer is applied in float.
+class QuantizedNetwork
+{
+public:
+    QuantizedNetwork(const Network& network,
+                     const ConstMatrixView calibration,
+                     const Granularity granularity = Granularity::PerNeuron)
+        : topology_{network.get_topology()}, precision_{network.get_precision()}
+    {
+        assert(calibration.get_rows() > 0);
+        assert(calibration.get_cols() == network.get_input_count());
+        const auto ranges = calibrate(network, calibration);
+        const auto& layers = topology_->get_layers();
+        std::size_t size = 0;
+        for (const auto& layer : layers)
+        {
+            size += layer.neurons.size() * layer.n_inputs;
+        }
+        weights_.resize(size);
+        std::size_t offset = 0;
+        for (std::size_t i = 0; i < layers.size(); ++i)
+        {
+            layers_.push_back(quantize_layer(network, layers[i], ranges[i], granularity, offset));
+            offset += layers_.back().n_outputs * layers_.back().n_inputs;
+        }
+    }
+
+    TargetType get_target_type() const
+    {
+        return topology_->get_target_type();
+    }
+
+    std::vector<std::size_t> get_layers() const
+    {
+        std::vector<std::size_t> layers;
+        for (const Layer& layer : layers_)
+        {
+            layers.push_back(layer.n_outputs);
+        }
+        return layers;
+    }
+
+    // bytes taken by the weights, scales and offsets
+    std::size_t get_size() const
+    {
+        std::size_t size = weights_.size() * sizeof(std::int8_t);
+        for (const Layer& layer : layers_)
+        {
+            size += (layer.scales.size() + layer.offsets.size()) * sizeof(float);
+        }
+        return size;
+    }
+
+    std::vector<float> predict(const std::vector<float>& input) const
+    {
+        assert(input.size() == layers_.front().n_inputs);
+        std::vector<float> output(layers_.back().n_outputs);
+        predict(input.data(), output.data());
+        return output;
+    }
+
+    // reads get_layers().front() inputs and writes get_layers().back() outputs
+    void predict(const float* input,
+                 float* output) const
+    {
+        Buffers buffers{get_max_layer_size()};
+        predict_row(input, output, buffers);
+    }
+
+    // scores the rows of X, one sample per row
+    Matrix predict_batch(const ConstMatrixView X) const
+    {
+        Matrix out{X.get_rows(), layers_.back().n_outputs};
+        predict_batch(X, out);
+        return out;
+    }
+
+    void predict_batch(const ConstMatrixView X,
+                       const MatrixView out) const
+    {
+        assert(X.get_cols() == layers_.front().n_inputs);
+        assert(out.get_rows() == X.get_rows());
+        assert(out.get_cols() == layers_.back().n_outputs);
+        Buffers buffers{get_max_layer_size()};
+        for (std::size_t r = 0; r < X.get_rows(); ++r)
+        {
+            predict_row(X.get_row(r), out.get_row(r), buffers);
+        }
+    }
+
+    void predict_batch(const ConstMatrixView X,
+                       const MatrixView out,
+                       ThreadPool& pool) const
+    {
+        assert(X.get_cols() == layers_.front().n_inputs);
+        assert(out.get_rows() == X.get_rows());
+        assert(out.get_cols() == layers_.back().n_outputs);
+        std::vector<Buffers> buffers(pool.get_thread_count(), Buffers{get_max_layer_size()});
+        const auto n_tiles = (X.get_rows() + predict_tile_size - 1) / predict_tile_size;
+        pool.parallel_for(n_tiles, [&](const std::size_t tile, const std::size_t thread_index)
+        {
+            const auto end = std::min((tile + 1) * predict_tile_size, X.get_rows());
+            for (auto r = tile * predict_tile_size; r < end; ++r)
+            {
+                predict_row(X.get_row(r), out.get_row(r), buffers[thread_index]);
+            }
+        });
+    }
+
+private:
+    // The weights of a layer are a row-major n_outputs x n_inputs block of
+    // weights_. The output j is scales[j] * dot + offsets[j] where dot is
+    // the int32 product of the weights and the quantized inputs, and the
+    // offsets hold the bias and the correction for the input zero point.
+    // The transfer belongs to the shared topology.
+    struct Layer
+    {
+        const transfer::Transfer* transfer = nullptr;
+        std::size_t n_inputs = 0;
+        std::size_t n_outputs = 0;
+        std::size_t weight_offset = 0;
+        float input_scale = 1;
+        std::int32_t input_zero_point = 0;
+        std::vector<float> scales;
+        std::vector<float> offsets;
+    };
+
+    // the range of the inputs of a layer on the calibration data
+    struct Range
+    {
+        float min = 0;
+        float max = 0;
+    };
+
+    struct Buffers
+    {
+        explicit
+        Buffers(const std::size_t size)
+            : inputs(size), dots(size), outputs{std::vector<float>(size), std::vector<float>(size)}
+        {}
+
+        std::vector<std::uint8_t> inputs;
+        std::vector<std::int32_t> dots;
+        std::vector<float> outputs[2];
+    };
+
+    // number of rows which the parallel predict_batch scores per task
+    static constexpr std::size_t predict_tile_size = 64;
+
+    // Runs the float network over the calibration data and records the
+    // range of the inputs of every layer. The ranges always include zero so
+    // that it is exact after quantization.
+    static std::vector<Range> calibrate(const Network& network,
+                                        const ConstMatrixView calibration)
+    {
+        const auto& layers = network.get_topology()->get_layers();
+        std::vector<Range> ranges(layers.size());
+        std::size_t max_size = 0;
+        for (const auto& layer : layers)
+        {
+            max_size = std::max(max_size, layer.neurons.size());
+        }
+        std::vector<float> buffers[2] = {std::vector<float>(max_size), std::vector<float>(max_size)};
+        for (std::size_t r = 0; r < calibration.get_rows(); ++r)
+        {
+            const float* current = calibration.get_row(r);
+            for (std::size_t i = 0; i < layers.size(); ++i)
+            {
+                const auto& layer = layers[i];
+                const auto bounds = std::minmax_element(current, current + layer.n_inputs);
+                ranges[i].min = std::min(ranges[i].min, *bounds.first);
+                ranges[i].max = std::max(ranges[i].max, *bounds.second);
+                float* next = buffers[i % 2].data();
+                const float* W = network.get_weights().data() + layer.get_weight_offset();
+                const auto stride = layer.get_weight_stride();
+                kernels::gemv(layer.neurons.size(), layer.n_inputs, W, stride, current, next);
+                for (std::size_t j = 0; j < layer.neurons.size(); ++j)
+                {
+                    next[j] += W[j * stride + layer.n_inputs]; // bias
+                }
+                layer.transfer->apply(next, layer.neurons.size(), network.get_precision());
+                current = next;
+            }
+        }
+        return ranges;
+    }
+
+    Layer quantize_layer(const Network& network,
+                         const Topology::Layer& source,
+                         const Range& range,
+                         const Granularity granularity,
+                         const std::size_t weight_offset)
+    {
+        Layer layer;
+        layer.transfer = source.transfer.get();
+        layer.n_inputs = source.n_inputs;
+        layer.n_outputs = source.neurons.size();
+        layer.weight_offset = weight_offset;
+        layer.input_scale = range.max > range.min ? (range.max - range.min) / 255.0f : 1.0f;
+        layer.input_zero_point = static_cast<std::int32_t>(std::min(255.0f, std::nearbyint(-range.min / layer.input_scale)));
+
+        const float* W = network.get_weights().data() + source.get_weight_offset();
+        const auto stride = source.get_weight_stride();
+        std::vector<float> max_weights(layer.n_outputs);
+        for (std::size_t j = 0; j < layer.n_outputs; ++j)
+        {
+            for (std::size_t k = 0; k < layer.n_inputs; ++k)
+            {
+                max_weights[j] = std::max(max_weights[j], std::abs(W[j * stride + k]));
+            }
+        }
+        if (granularity == Granularity::PerLayer)
+        {
+            std::fill(max_weights.begin(), max_weights.end(),
+                      *std::max_element(max_weights.begin(), max_weights.end()));
+        }
+
+        layer.scales.resize(layer.n_outputs);
+        layer.offsets.resize(layer.n_outputs);
+        for (std::size_t j = 0; j < layer.n_outputs; ++j)
+        {
+            const auto weight_scale = max_weights[j] > 0 ? max_weights[j] / 127.0f : 1.0f;
+            std::int8_t* q = weights_.data() + weight_offset + j * layer.n_inputs;
+            std::int32_t sum = 0;
+            for (std::size_t k = 0; k < layer.n_inputs; ++k)
+            {
+                const auto value = std::nearbyint(W[j * stride + k] / weight_scale);
+                q[k] = static_cast<std::int8_t>(std::max(-127.0f, std::min(127.0f, value)));
+                sum += q[k];
+            }
+            // sum_k w_k (x_k - z) = dot - z * sum_k w_k
+            layer.scales[j] = layer.input_scale * weight_scale;
+            layer.offsets[j] = W[j * stride + layer.n_inputs]
+                             - layer.scales[j] * static_cast<float>(layer.input_zero_point * sum);
+        }
+        return layer;
+    }
+
+    static void quantize(const float* x,
+                         std::uint8_t* q,
+                         const std::size_t n,
+                         const float scale,
+                         const std::int32_t zero_point)
+    {
+        const auto inverse_scale = 1.0f / scale;
+        const auto offset = static_cast<float>(zero_point) + 0.5f;
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            // rounds by truncation after the clamp, which vectorizes unlike nearbyint
+            const auto value = std::max(0.0f, std::min(255.0f, x[i] * inverse_scale + offset));
+            q[i] = static_cast<std::uint8_t>(static_cast<std::int32_t>(value));
+        }
+    }
+
+    void predict_row(const float* input,
+                     float* output,
+                     Buffers& buffers) const
+    {
+        const float* current = input;
+        for (std::size_t i = 0; i < layers_.size(); ++i)
+        {
+            const Layer& layer = layers_[i];
+            float* next = i + 1 == layers_.size() ? output : buffers.outputs[i % 2].data();
+            quantize(current, buffers.inputs.data(), layer.n_inputs, layer.input_scale, layer.input_zero_point);
+            kernels::gemv_u8s8(layer.n_outputs, layer.n_inputs, weights_.data() + layer.weight_offset,
+                               layer.n_inputs, buffers.inputs.data(), buffers.dots.data());
+            for (std::size_t j = 0; j < layer.n_outputs; ++j)
+            {
+                next[j] = layer.scales[j] * static_cast<float>(buffers.dots[j]) + layer.offsets[j];
+            }
+            layer.transfer->apply(next, layer.n_outputs, precision_);
+            current = next;
+        }
+        topology_->get_loss().transform_output(output, layers_.back().n_outputs);
+    }
+
+    std::size_t get_max_layer_size() const
+    {
+        std::size_t size = 0;
+        for (const Layer& layer : layers_)
+        {
+            size = std::max({size, layer.n_inputs, layer.n_outputs});
+        }
+        return size;
+    }
+
+    std::shared_ptr<const Topology> topology_;
+    transfer::Precision precision_;
+    std::vector<Layer> layers_;
+    std::vector<std::int8_t> weights_;
+};
+
+// How far the outputs of a quantized network are from those of the float
+// network it was built from, on a dataset with known targets.
+struct QuantizationReport
+{
+    float float_mae = 0; // of the float network against the targets
+    float quantized_mae = 0; // of the quantized network against the targets
+    float mean_difference = 0; // mean absolute difference of the outputs
+    float max_difference = 0; // largest absolute difference of the outputs
+    float agreement = 0; // fraction of rows with the same largest output
+    std::size_t float_size = 0; // bytes of the float weights
+    std::size_t quantized_size = 0; // bytes of the quantized weights
+};
+
+inline QuantizationReport compare(const Network& network,
+                                  const QuantizedNetwork& quantized,
+                                  const ConstMatrixView X,
+                                  const ConstMatrixView y)
+{
+    assert(X.get_rows() == y.get_rows());
+    assert(X.get_rows() > 0);
+    const auto pred = network.predict_batch(X);
+    const auto quantized_pred = quantized.predict_batch(X);
+    QuantizationReport report;
+    report.float_mae = mae(y, pred);
+    report.quantized_mae = mae(y, quantized_pred);
+    double sum = 0;
+    std::size_t n_agree = 0;
+    for (std::size_t i = 0; i < pred.get_rows(); ++i)
+    {
+        const float* a = pred.get_row(i);
+        const float* b = quantized_pred.get_row(i);
+        const auto n = pred.get_cols();
+        for (std::size_t j = 0; j < n; ++j)
+        {
+            const auto difference = std::abs(a[j] - b[j]);
+            sum += difference;
+            report.max_difference = std::max(report.max_difference, difference);
+        }
+        n_agree += std::max_element(a, a + n) - a == std::max_element(b, b + n) - b;
+    }
+    report.mean_difference = static_cast<float>(sum / static_cast<double>(pred.get_rows() * pred.get_cols()));
+    report.agreement = static_cast<float>(n_agree) / static_cast<float>(pred.get_rows());
+    report.float_size = network.get_weights().size() * sizeof(float);
+    report.quantized_size = quantized.get_size();
+    return report;
+}
+
+}
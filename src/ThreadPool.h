@@ -0,0 +1,164 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace gmlp
+{
+
+// A fixed set of threads running parallel loops. The calling thread takes
+// part in every loop so a pool of n threads starts n - 1 workers and a pool
+// of one thread runs everything on the caller.
+class ThreadPool
+{
+public:
+    explicit
+    ThreadPool(const std::size_t n_threads = default_thread_count())
+    {
+        assert(n_threads > 0);
+        for (std::size_t i = 1; i < n_threads; ++i)
+        {
+            workers_.emplace_back([this, i] { work(i); });
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            done_ = true;
+        }
+        wake_.notify_all();
+        for (auto& worker : workers_)
+        {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    static std::size_t default_thread_count()
+    {
+        const auto n_threads = std::thread::hardware_concurrency();
+        return n_threads > 0 ? n_threads : 1;
+    }
+
+    std::size_t get_thread_count() const
+    {
+        return workers_.size() + 1;
+    }
+
+    // Calls function(index, thread_index) for every index in [0, n) and
+    // returns once all calls have finished. thread_index is in
+    // [0, get_thread_count()) and identifies the thread making the call so
+    // that it can use per-thread state. Indices are handed out in order but
+    // which thread runs which index is unspecified. Loops started from
+    // several threads run one after another; function must not start a loop
+    // on the same pool. If function throws, no further indices are started
+    // and the first exception is rethrown once the running calls have finished.
+    void parallel_for(const std::size_t n,
+                      const std::function<void(std::size_t, std::size_t)>& function)
+    {
+        if (n == 0)
+        {
+            return;
+        }
+        std::lock_guard<std::mutex> loop_lock{loop_mutex_};
+        if (workers_.empty() || n == 1)
+        {
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                function(i, 0);
+            }
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            function_ = &function;
+            size_ = n;
+            next_.store(0);
+            active_ = workers_.size();
+            ++generation_;
+        }
+        wake_.notify_all();
+        run(0);
+        std::unique_lock<std::mutex> lock{mutex_};
+        finished_.wait(lock, [this] { return active_ == 0; });
+        function_ = nullptr;
+        if (error_)
+        {
+            std::rethrow_exception(std::exchange(error_, nullptr));
+        }
+    }
+
+private:
+    // Runs indices until there are none left. The first exception thrown by
+    // any thread stops the hand out of further indices and is rethrown by
+    // parallel_for once every thread has finished.
+    void run(const std::size_t thread_index)
+    {
+        for (auto i = next_.fetch_add(1); i < size_; i = next_.fetch_add(1))
+        {
+            try
+            {
+                (*function_)(i, thread_index);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock{mutex_};
+                if (!error_)
+                {
+                    error_ = std::current_exception();
+                }
+                next_.store(size_);
+            }
+        }
+    }
+
+    void work(const std::size_t thread_index)
+    {
+        std::size_t generation = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock{mutex_};
+                wake_.wait(lock, [this, generation] { return done_ || generation_ != generation; });
+                if (done_)
+                {
+                    return;
+                }
+                generation = generation_;
+            }
+            run(thread_index);
+            {
+                std::lock_guard<std::mutex> lock{mutex_};
+                --active_;
+            }
+            finished_.notify_one();
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::mutex loop_mutex_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable finished_;
+    const std::function<void(std::size_t, std::size_t)>* function_ = nullptr;
+    std::size_t size_ = 0;
+    std::atomic<std::size_t> next_{0};
+    std::size_t active_ = 0;
+    std::size_t generation_ = 0;
+    std::exception_ptr error_;
+    bool done_ = false;
+};
+
+}
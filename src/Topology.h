@@ -0,0 +1,278 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "half.h"
+#include "init.h"
+#include "kernels.h"
+#include "loss.h"
+#include "Matrix.h"
+#include "Neuron.h"
+#include "transfer.h"
+
+namespace gmlp
+{
+
+enum TargetType : std::uint8_t
+{
+    Classification,
+    Regression,
+};
+
+// The architecture of a network: its layers with their transfers and weight
+// layout, and the loss. A topology never changes once built, so networks of
+// the same architecture share one through a shared_ptr to const and each
+// only adds its own weights. Cloning a network then copies just the weights.
+class Topology
+{
+public:
+    // The weights of a layer form one contiguous row-major matrix inside the
+    // weights of a network with one row of n_inputs + 1 (bias) values per
+    // neuron.
+    struct Layer
+    {
+        std::unique_ptr<transfer::Transfer> transfer;
+        std::vector<Neuron> neurons;
+        std::size_t n_inputs = 0;
+
+        std::size_t get_weight_offset() const
+        {
+            return neurons.front().get_weight_offset();
+        }
+
+        std::size_t get_weight_stride() const
+        {
+            return n_inputs + 1; // weights + bias
+        }
+    };
+
+    Topology(const TargetType target_type,
+             const std::vector<std::size_t>& layers)
+        : target_type_{target_type}
+    {
+        assert(layers.size() > 1);
+        layers_.resize(layers.size());
+        for (std::size_t i = 0; i < layers.size(); ++i)
+        {
+            assert(layers[i] > 0);
+            Layer& layer = layers_[i];
+            const bool is_output = i + 1 == layers.size();
+            if (is_output && target_type == TargetType::Regression)
+            {
+                layer.transfer = std::make_unique<transfer::Linear>();
+            }
+            else
+            {
+                layer.transfer = std::make_unique<transfer::Sigmoid>();
+            }
+            // the input layer has one neuron per input
+            layer.n_inputs = i == 0 ? layers[0] : layers[i - 1];
+            for (std::size_t j = 0; j < layers[i]; ++j)
+            {
+                layer.neurons.emplace_back(weight_count_);
+                weight_count_ += layer.get_weight_stride();
+            }
+        }
+
+        if (target_type == TargetType::Classification && layers.back() > 1)
+        {
+            loss_ = std::make_unique<loss::CE>();
+        }
+        else
+        {
+            loss_ = std::make_unique<loss::SE>();
+        }
+    }
+
+    Topology(const Topology&) = delete;
+    Topology& operator=(const Topology&) = delete;
+
+    TargetType get_target_type() const
+    {
+        return target_type_;
+    }
+
+    const std::vector<Layer>& get_layers() const
+    {
+        return layers_;
+    }
+
+    // the number of neurons of every layer
+    std::vector<std::size_t> get_layer_sizes() const
+    {
+        std::vector<std::size_t> sizes;
+        for (const Layer& layer : layers_)
+        {
+            sizes.push_back(layer.neurons.size());
+        }
+        return sizes;
+    }
+
+    const loss::Loss& get_loss() const
+    {
+        return *loss_;
+    }
+
+    std::size_t get_weight_count() const
+    {
+        return weight_count_;
+    }
+
+    std::size_t get_max_layer_size() const
+    {
+        std::size_t size = 0;
+        for (const Layer& layer : layers_)
+        {
+            size = std::max(size, layer.neurons.size());
+        }
+        return size;
+    }
+
+    // the number of floats which pack needs
+    std::size_t get_packed_size() const
+    {
+        std::size_t size = 0;
+        for (const Layer& layer : layers_)
+        {
+            size += kernels::packed_size(layer.neurons.size(), layer.n_inputs);
+        }
+        return size;
+    }
+
+    // packs the weights of all layers for kernels::gemm_packed
+    template<typename T>
+    void pack(const T* weights,
+              float* packed) const
+    {
+        for (const Layer& layer : layers_)
+        {
+            kernels::pack_nt(weights + layer.get_weight_offset(), layer.get_weight_stride(),
+                             layer.neurons.size(), layer.n_inputs, packed);
+            packed += kernels::packed_size(layer.neurons.size(), layer.n_inputs);
+        }
+    }
+
+    // Passes a tile of rows of X through the layers with the given weights
+    // and writes the outputs to out. packed are the weights packed by pack or
+    // null to read them in place. The activations of the hidden layers
+    // alternate between the two buffers of get_max_layer_size() values per
+    // row. Every network and population predicts through this function, so
+    // their outputs agree bit for bit.
+    template<typename T>
+    void predict_tile(const T* weights,
+                      const float* packed,
+                      const ConstMatrixView X,
+                      const MatrixView out,
+                      const std::array<float*, 2>& buffers,
+                      const transfer::Precision precision) const
+    {
+        const auto n_rows = X.get_rows();
+        const float* current = X.get_data();
+        auto current_stride = X.get_stride();
+        for (std::size_t i = 0; i < layers_.size(); ++i)
+        {
+            const Layer& layer = layers_[i];
+            const auto n_outputs = layer.neurons.size();
+            const bool is_last = i + 1 == layers_.size();
+            float* next = is_last ? out.get_data() : buffers[i % 2];
+            const auto next_stride = is_last ? out.get_stride() : n_outputs;
+            const T* W = weights + layer.get_weight_offset();
+            const auto stride = layer.get_weight_stride();
+            if (packed)
+            {
+                kernels::gemm_packed(n_rows, n_outputs, layer.n_inputs,
+                                     current, current_stride,
+                                     packed, next, next_stride);
+                packed += kernels::packed_size(n_outputs, layer.n_inputs);
+            }
+            else
+            {
+                for (std::size_t r = 0; r < n_rows; ++r)
+                {
+                    gemv(n_outputs, layer.n_inputs, W, stride,
+                         current + r * current_stride, next + r * next_stride);
+                }
+            }
+            for (std::size_t r = 0; r < n_rows; ++r)
+            {
+                for (std::size_t j = 0; j < n_outputs; ++j)
+                {
+                    next[r * next_stride + j] += static_cast<float>(W[j * stride + layer.n_inputs]); // bias
+                }
+            }
+            if (next_stride == n_outputs)
+            {
+                layer.transfer->apply(next, n_rows * n_outputs, precision);
+            }
+            else
+            {
+                for (std::size_t r = 0; r < n_rows; ++r)
+                {
+                    layer.transfer->apply(next + r * next_stride, n_outputs, precision);
+                }
+            }
+            current = next;
+            current_stride = next_stride;
+        }
+        for (std::size_t r = 0; r < n_rows; ++r)
+        {
+            loss_->transform_output(out.get_row(r), out.get_cols());
+        }
+    }
+
+    // Draws xavier initialized weights for every neuron in turn into the
+    // get_weight_count() values of weights.
+    void initialize(init::RandomEngine& random_engine,
+                    float* weights) const
+    {
+        for (const Layer& layer : layers_)
+        {
+            for (const Neuron& neuron : layer.neurons)
+            {
+                init::xavier(random_engine, weights + neuron.get_weight_offset(), layer.get_weight_stride());
+            }
+        }
+    }
+
+    // The same from the counter-based generator for the given individual.
+    // Each weight only depends on the seed, the individual and its index, so
+    // any number of individuals can be initialized in parallel.
+    void initialize(const init::Philox& philox,
+                    const std::size_t individual,
+                    float* weights) const
+    {
+        for (const Layer& layer : layers_)
+        {
+            for (const Neuron& neuron : layer.neurons)
+            {
+                init::xavier(philox, individual, neuron.get_weight_offset(),
+                             weights + neuron.get_weight_offset(), layer.get_weight_stride());
+            }
+        }
+    }
+
+    // the number of weights of a topology with the given layer sizes
+    static std::size_t count_weights(const std::vector<std::size_t>& layers)
+    {
+        std::size_t count = layers.front() * (layers.front() + 1);
+        for (std::size_t i = 1; i < layers.size(); ++i)
+        {
+            count += layers[i] * (layers[i - 1] + 1);
+        }
+        return count;
+    }
+
+private:
+    TargetType target_type_;
+    std::vector<Layer> layers_;
+    std::unique_ptr<loss::Loss> loss_;
+    std::size_t weight_count_ = 0;
+};
+
+}
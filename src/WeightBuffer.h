@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "MappedFile.h"
+
+namespace gmlp
+{
+
+// The weights of a network, either owned or living inside a memory-mapped
+// model file which the buffer keeps open. Mapped weights are copy-on-write
+// like the MappedFile, so a mapped network can still be trained without
+// touching the file. Copies always own their weights.
+template<typename T>
+class WeightBuffer
+{
+public:
+    WeightBuffer() = default;
+
+    explicit
+    WeightBuffer(std::vector<T> values)
+        : owned_{std::move(values)}, data_{owned_.data()}, size_{owned_.size()}
+    {}
+
+    // the size values of type T at offset bytes into the file
+    WeightBuffer(MappedFile file,
+                 const std::size_t offset,
+                 const std::size_t size)
+        : file_{std::move(file)}, data_{reinterpret_cast<T*>(file_.get_data() + offset)}, size_{size}
+    {
+        assert(offset + size * sizeof(T) <= file_.get_size());
+    }
+
+    WeightBuffer(const WeightBuffer& other)
+        : WeightBuffer{std::vector<T>(other.begin(), other.end())}
+    {}
+
+    WeightBuffer(WeightBuffer&& other) noexcept
+        : owned_{std::move(other.owned_)}, file_{std::move(other.file_)},
+          data_{std::exchange(other.data_, nullptr)}, size_{std::exchange(other.size_, 0)}
+    {}
+
+    WeightBuffer& operator=(WeightBuffer other) noexcept
+    {
+        owned_ = std::move(other.owned_);
+        file_ = std::move(other.file_);
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+        return *this;
+    }
+
+    bool is_mapped() const
+    {
+        return file_.get_data() != nullptr;
+    }
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    T* data()
+    {
+        return data_;
+    }
+
+    const T* data() const
+    {
+        return data_;
+    }
+
+    T* begin()
+    {
+        return data_;
+    }
+
+    const T* begin() const
+    {
+        return data_;
+    }
+
+    T* end()
+    {
+        return data_ + size_;
+    }
+
+    const T* end() const
+    {
+        return data_ + size_;
+    }
+
+    T& operator[](const std::size_t index)
+    {
+        assert(index < size_);
+        return data_[index];
+    }
+
+    const T& operator[](const std::size_t index) const
+    {
+        assert(index < size_);
+        return data_[index];
+    }
+
+private:
+    std::vector<T> owned_;
+    MappedFile file_;
+    T* data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+}
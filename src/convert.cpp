@@ -0,0 +1,31 @@
+#include <iostream>
+#include <string>
+
+#include "csv.h"
+#include "Dataset.h"
+
+// Converts a text file with one sample per line and values separated by
+// commas or whitespace into the binary dataset format. The last n_targets
+// columns are the targets.
+int main(int argc, char** argv)
+{
+    if (argc < 3 || argc > 4)
+    {
+        std::cerr << "usage: " << argv[0] << " <input.csv> <output> [n_targets=1]" << std::endl;
+        return 1;
+    }
+    gmlp::csv::Options options;
+    options.n_targets = argc == 4 ? std::stoul(argv[3]) : 1;
+    try
+    {
+        const auto dataset = gmlp::csv::read(argv[1], options);
+        dataset.save(argv[2]);
+        std::cout << "wrote " << dataset.get_rows() << " rows with " << dataset.get_X().get_cols()
+                  << " features and " << dataset.get_y().get_cols() << " targets to " << argv[2] << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
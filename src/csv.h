@@ -0,0 +1,310 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Dataset.h"
+#include "MappedFile.h"
+#include "Matrix.h"
+#include "ThreadPool.h"
+
+namespace gmlp
+{
+
+namespace csv
+{
+
+struct Options
+{
+    // values are separated by the delimiter and/or whitespace
+    char delimiter = ',';
+    // number of lines to skip at the beginning, e.g. a header
+    std::size_t skip_lines = 0;
+    // feature columns, all columns which are not targets if empty
+    std::vector<std::size_t> x_cols;
+    // target columns, the last n_targets columns if empty
+    std::vector<std::size_t> y_cols;
+    std::size_t n_targets = 1;
+};
+
+namespace detail
+{
+
+// files are split into chunks of about this many bytes for parsing
+constexpr std::size_t chunk_size = std::size_t{1} << 20;
+
+inline bool is_space(const char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline const char* skip_spaces(const char* p,
+                               const char* end)
+{
+    while (p != end && is_space(*p))
+    {
+        ++p;
+    }
+    return p;
+}
+
+inline const char* find_line_end(const char* p,
+                                 const char* end)
+{
+    while (p != end && *p != '\n')
+    {
+        ++p;
+    }
+    return p;
+}
+
+// whether the line holds anything but whitespace
+inline bool is_data_line(const char* p,
+                         const char* end)
+{
+    return skip_spaces(p, end) != end;
+}
+
+// Where the columns of a file go in the dataset, the features followed by
+// the targets. Columns which are neither map to unused. A column may only be
+// used once, as a feature or as a target.
+struct Layout
+{
+    std::vector<std::size_t> column_map;
+    std::size_t x_cols = 0;
+    std::size_t y_cols = 0;
+};
+
+constexpr auto unused = static_cast<std::size_t>(-1);
+
+inline Layout make_layout(const std::string& path,
+                          const std::size_t n_file_cols,
+                          const Options& options)
+{
+    auto y_cols = options.y_cols;
+    if (y_cols.empty())
+    {
+        if (options.n_targets > n_file_cols)
+        {
+            throw std::runtime_error{path + " has fewer columns than targets"};
+        }
+        for (auto col = n_file_cols - options.n_targets; col < n_file_cols; ++col)
+        {
+            y_cols.push_back(col);
+        }
+    }
+    Layout layout;
+    layout.column_map.assign(n_file_cols, unused);
+    for (std::size_t i = 0; i < y_cols.size(); ++i)
+    {
+        if (y_cols[i] >= n_file_cols)
+        {
+            throw std::runtime_error{path + " has no column " + std::to_string(y_cols[i])};
+        }
+        if (layout.column_map[y_cols[i]] != unused)
+        {
+            throw std::runtime_error{path + ": column " + std::to_string(y_cols[i]) + " is used twice"};
+        }
+        layout.column_map[y_cols[i]] = i; // moved behind the features below
+    }
+    auto x_cols = options.x_cols;
+    if (x_cols.empty())
+    {
+        for (std::size_t col = 0; col < n_file_cols; ++col)
+        {
+            if (layout.column_map[col] == unused)
+            {
+                x_cols.push_back(col);
+            }
+        }
+    }
+    for (auto& index : layout.column_map)
+    {
+        index = index == unused ? unused : index + x_cols.size();
+    }
+    for (std::size_t i = 0; i < x_cols.size(); ++i)
+    {
+        if (x_cols[i] >= n_file_cols)
+        {
+            throw std::runtime_error{path + " has no column " + std::to_string(x_cols[i])};
+        }
+        if (layout.column_map[x_cols[i]] != unused)
+        {
+            throw std::runtime_error{path + ": column " + std::to_string(x_cols[i]) + " is used twice"};
+        }
+        layout.column_map[x_cols[i]] = i;
+    }
+    layout.x_cols = x_cols.size();
+    layout.y_cols = y_cols.size();
+    return layout;
+}
+
+// Parses the values of the line [p, end) and calls on_value(col, value) for
+// each. Returns the number of values or -1 if the line is malformed.
+template<typename F>
+long parse_line(const char* p,
+                const char* end,
+                const char delimiter,
+                F&& on_value)
+{
+    long col = 0;
+    for (;;)
+    {
+        p = skip_spaces(p, end);
+        if (p != end && *p == '+')
+        {
+            ++p; // from_chars does not accept a plus sign
+        }
+        float value;
+        const auto result = std::from_chars(p, end, value);
+        if (result.ec != std::errc{})
+        {
+            return -1;
+        }
+        on_value(static_cast<std::size_t>(col++), value);
+        p = skip_spaces(result.ptr, end);
+        if (p == end)
+        {
+            return col;
+        }
+        if (*p == delimiter)
+        {
+            ++p;
+        }
+        else if (p == result.ptr)
+        {
+            return -1; // not separated
+        }
+    }
+}
+
+}
+
+// Parses a text file with one sample per line into a dataset. The file is
+// memory-mapped and split into newline-aligned chunks which are parsed on the
+// pool, each writing its rows straight into the contiguous dataset. Blank
+// lines are ignored. Throws std::runtime_error if the file cannot be read,
+// a value is malformed or the lines differ in their number of columns.
+inline Dataset read(const std::string& path,
+                    const Options& options,
+                    ThreadPool& pool)
+{
+    const MappedFile file{path};
+    const char* const file_begin = file.get_data();
+    const char* end = file_begin + file.get_size();
+    const char* begin = file_begin;
+    for (std::size_t i = 0; i < options.skip_lines && begin != end; ++i)
+    {
+        begin = detail::find_line_end(begin, end);
+        begin += begin != end;
+    }
+
+    // the columns of the first line define the layout
+    const char* first = begin;
+    while (first != end && !detail::is_data_line(first, detail::find_line_end(first, end)))
+    {
+        first = detail::find_line_end(first, end);
+        first += first != end;
+    }
+    const auto n_cols = detail::parse_line(first, detail::find_line_end(first, end),
+                                           options.delimiter, [](std::size_t, float) {});
+    if (first != end && n_cols < 0)
+    {
+        throw std::runtime_error{path + ": malformed value in the first line"};
+    }
+    const auto n_file_cols = first == end ? std::size_t{0} : static_cast<std::size_t>(n_cols);
+
+    const auto layout = detail::make_layout(path, n_file_cols, options);
+    const auto& column_map = layout.column_map;
+    const auto n_out_cols = layout.x_cols + layout.y_cols;
+
+    // newline-aligned chunks
+    std::vector<const char*> bounds{first};
+    while (bounds.back() != end)
+    {
+        const auto remaining = static_cast<std::size_t>(end - bounds.back());
+        const char* bound = bounds.back() + std::min(detail::chunk_size, remaining);
+        bound = detail::find_line_end(bound, end);
+        bounds.push_back(bound + (bound != end));
+    }
+    const auto n_chunks = bounds.size() - 1;
+
+    // first pass counts the rows of each chunk to know where they go and its
+    // lines to report errors by file line number
+    std::vector<std::size_t> row_offsets(n_chunks + 1);
+    std::vector<std::size_t> line_offsets(n_chunks + 1);
+    line_offsets[0] = static_cast<std::size_t>(std::count(file_begin, first, '\n'));
+    pool.parallel_for(n_chunks, [&](const std::size_t chunk, std::size_t)
+    {
+        std::size_t rows = 0;
+        std::size_t lines = 0;
+        for (const char* line = bounds[chunk]; line != bounds[chunk + 1]; ++lines)
+        {
+            const char* line_end = detail::find_line_end(line, bounds[chunk + 1]);
+            rows += detail::is_data_line(line, line_end);
+            line = line_end + (line_end != bounds[chunk + 1]);
+        }
+        row_offsets[chunk + 1] = rows;
+        line_offsets[chunk + 1] = lines;
+    });
+    for (std::size_t chunk = 0; chunk < n_chunks; ++chunk)
+    {
+        row_offsets[chunk + 1] += row_offsets[chunk];
+        line_offsets[chunk + 1] += line_offsets[chunk];
+    }
+
+    Matrix data{row_offsets.back(), n_out_cols};
+    std::vector<std::string> errors(n_chunks);
+    pool.parallel_for(n_chunks, [&](const std::size_t chunk, std::size_t)
+    {
+        auto row = row_offsets[chunk];
+        auto line_number = line_offsets[chunk];
+        for (const char* line = bounds[chunk]; line != bounds[chunk + 1];)
+        {
+            ++line_number;
+            const char* line_end = detail::find_line_end(line, bounds[chunk + 1]);
+            if (detail::is_data_line(line, line_end))
+            {
+                float* out = data.get_row(row);
+                const auto cols = detail::parse_line(line, line_end, options.delimiter,
+                                                     [&](const std::size_t col, const float value)
+                {
+                    if (col < n_file_cols && column_map[col] != detail::unused)
+                    {
+                        out[column_map[col]] = value;
+                    }
+                });
+                if (cols != n_cols)
+                {
+                    errors[chunk] = path + ": malformed line " + std::to_string(line_number);
+                    return;
+                }
+                ++row;
+            }
+            line = line_end + (line_end != bounds[chunk + 1]);
+        }
+    });
+    for (const auto& error : errors)
+    {
+        if (!error.empty())
+        {
+            throw std::runtime_error{error};
+        }
+    }
+    return {std::move(data), layout.x_cols};
+}
+
+inline Dataset read(const std::string& path,
+                    const Options& options = {})
+{
+    ThreadPool pool;
+    return read(path, options, pool);
+}
+
+}
+
+}
@@ -1,47 +1,139 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <random>
 #include <vector>
 
 #include "init.h"
+#include "Matrix.h"
 #include "Network.h"
+#include "Population.h"
+#include "ThreadPool.h"
 #include "utils.h"
 
 namespace gmlp
 {
 
-inline void crossover(std::vector<float>& w1,
-                      std::vector<float>& w2,
+namespace detail
+{
+
+// The number of weights to skip, geometric with log_q = log(1 - ratio). It
+// is capped at n before the conversion since a tiny ratio gives gaps beyond
+// the range of std::size_t, or infinite ones.
+inline std::size_t skip(const std::uint32_t bits,
+                        const float log_q,
+                        const std::size_t n)
+{
+    const auto gap = std::log(init::Philox::to_uniform(bits)) / log_q;
+    return static_cast<std::size_t>(std::min(gap, static_cast<float>(n)));
+}
+
+}
+
+// The operators change each weight with probability ratio. Rather than
+// drawing a number per weight they skip to the next weight to change by a
+// geometrically distributed gap, so their cost is proportional to the number
+// of weights changed.
+inline void crossover(float* w1,
+                      float* w2,
+                      const std::size_t n,
+                      const float ratio,
+                      init::RandomEngine& random_engine)
+{
+    assert(ratio > 0.0f);
+    assert(ratio < 1.0f);
+    std::geometric_distribution<std::size_t> skip{ratio};
+    for (auto i = skip(random_engine); i < n; i += skip(random_engine) + 1)
+    {
+        std::swap(w1[i], w2[i]);
+    }
+}
+
+inline void crossover(WeightBuffer<float>& w1,
+                      WeightBuffer<float>& w2,
                       const float ratio,
                       init::RandomEngine& random_engine)
 {
     assert(w1.size() == w2.size());
+    crossover(w1.data(), w2.data(), w1.size(), ratio, random_engine);
+}
+
+inline void mutate(float* w,
+                   const std::size_t n,
+                   const float ratio,
+                   const float sigma,
+                   init::RandomEngine& random_engine)
+{
+    assert(ratio > 0.0f);
+    assert(ratio < 1.0f);
+    std::geometric_distribution<std::size_t> skip{ratio};
+    std::normal_distribution<float> normal(0.0f, sigma);
+    for (auto i = skip(random_engine); i < n; i += skip(random_engine) + 1)
+    {
+        w[i] += w[i] * normal(random_engine);
+    }
+}
+
+inline void mutate(WeightBuffer<float>& w,
+                   const float ratio,
+                   const float sigma,
+                   init::RandomEngine& random_engine)
+{
+    mutate(w.data(), w.size(), ratio, sigma, random_engine);
+}
+
+// The counter-based versions of the operators for the n weights of a pair or
+// an individual of a generation. They draw the random numbers of the k-th
+// change from Philox counter k, so pairs and individuals can be processed in
+// parallel and in any order with the same result.
+inline void crossover(float* w1,
+                      float* w2,
+                      const std::size_t n,
+                      const float ratio,
+                      const init::Philox& philox,
+                      const std::size_t generation,
+                      const std::size_t pair)
+{
     assert(ratio > 0.0f);
     assert(ratio < 1.0f);
-    std::uniform_real_distribution<float> uniform;
-    for (std::size_t i = 0; i < w1.size(); ++i)
+    const auto log_q = std::log1p(-ratio);
+    for (std::size_t i = 0, k = 0;; ++i, ++k)
     {
-        if (uniform(random_engine) < ratio)
+        const auto bits = philox(k, pair, generation, init::Stream::Crossover);
+        i += detail::skip(bits[0], log_q, n);
+        if (i >= n)
         {
-            std::swap(w1[i], w2[i]);
+            break;
         }
+        std::swap(w1[i], w2[i]);
     }
 }
 
-inline void mutate(std::vector<float>& w,
+inline void mutate(float* w,
+                   const std::size_t n,
                    const float ratio,
                    const float sigma,
-                   init::RandomEngine& random_engine)
+                   const init::Philox& philox,
+                   const std::size_t generation,
+                   const std::size_t individual)
 {
     assert(ratio > 0.0f);
     assert(ratio < 1.0f);
-    std::uniform_real_distribution<float> uniform;
-    std::normal_distribution<float> normal(0.0f, sigma);
-    for (std::size_t i = 0; i < w.size(); ++i)
+    const auto log_q = std::log1p(-ratio);
+    for (std::size_t i = 0, k = 0;; ++i, ++k)
     {
-        if (uniform(random_engine) < ratio)
+        const auto bits = philox(k, individual, generation, init::Stream::Mutation);
+        i += detail::skip(bits[0], log_q, n);
+        if (i >= n)
         {
-            w[i] += w[i] * normal(random_engine);
+            break;
         }
+        w[i] += w[i] * sigma * init::Philox::to_normal(bits[1], bits[2]);
     }
 }
 
@@ -54,36 +146,96 @@ struct Model
 inline std::vector<Model> make_population(const std::size_t population_size,
                                           const TargetType target_type,
                                           const std::vector<std::size_t>& layers,
-                                          init::RandomEngine& random_engine)
+                                          init::RandomEngine& random_engine,
+                                          const transfer::Precision precision = transfer::Precision::Exact)
 {
+    const auto topology = std::make_shared<const Topology>(target_type, layers);
     std::vector<Model> population;
     for (std::size_t p = 0; p < population_size; ++p)
     {
-        gmlp::Network net{target_type, layers, random_engine};
+        gmlp::Network net{topology, random_engine};
+        net.set_precision(precision);
         population.push_back({-1.0f, std::move(net)});
     }
     return population;
 }
 
+// Keeps the n_fittest individuals with the lowest MAE on X and y, sorted by
+// it, and returns their losses. Individuals with equal loss keep their
+// order so the result does not depend on the thread count.
+inline std::vector<float> select_fittest(Population& population,
+                                         const std::size_t n_fittest,
+                                         const ConstMatrixView X,
+                                         const ConstMatrixView y,
+                                         ThreadPool& pool)
+{
+    const auto losses = population.evaluate(X, y, pool);
+    std::vector<std::size_t> order(losses.size());
+    std::iota(order.begin(), order.end(), std::size_t{0});
+    std::stable_sort(order.begin(), order.end(), [&](const std::size_t a, const std::size_t b)
+    {
+        return losses[a] < losses[b];
+    });
+    order.resize(std::min(n_fittest, order.size()));
+    population.select(order);
+    std::vector<float> selected_losses;
+    for (const auto individual : order)
+    {
+        selected_losses.push_back(losses[individual]);
+    }
+    return selected_losses;
+}
+
+// The same for models of one architecture and precision. Their weights are
+// gathered into a Population which scores them all in one pass over the data.
+// This copies every genome on each call, ga_optimize therefore keeps its
+// individuals in a Population throughout.
 inline void select_fittest(std::vector<Model>& population,
                            const std::size_t n_fittest,
-                           const std::vector<std::vector<float>>& X,
-                           const std::vector<std::vector<float>>& y)
+                           const ConstMatrixView X,
+                           const ConstMatrixView y,
+                           ThreadPool& pool)
 {
-    for (auto& model : population)
+    if (population.empty())
     {
-        std::vector<std::vector<float>> pred;
-        for (const auto& row : X)
-        {
-            pred.emplace_back(model.net.predict(row));
-        }
-        model.loss = gmlp::mae(y, pred);
+        return;
     }
-    std::sort(population.begin(), population.end(), [](const auto& x, const auto& y)
+    const auto& first = population.front().net;
+    Population genomes{first.get_topology(), first.get_precision()};
+    for (const auto& model : population)
+    {
+        assert(model.net.get_layers() == first.get_layers());
+        assert(model.net.get_precision() == first.get_precision());
+        genomes.add(model.net.get_weights().data());
+    }
+    const auto losses = genomes.evaluate(X, y, pool);
+    for (std::size_t i = 0; i < population.size(); ++i)
+    {
+        population[i].loss = losses[i];
+    }
+    std::stable_sort(population.begin(), population.end(), [](const auto& x, const auto& y)
     {
         return x.loss < y.loss;
     });
-    population.erase(population.begin() + n_fittest, population.end());
+    population.erase(population.begin() + static_cast<std::ptrdiff_t>(std::min(n_fittest, population.size())),
+                     population.end());
+}
+
+inline void select_fittest(std::vector<Model>& population,
+                           const std::size_t n_fittest,
+                           const ConstMatrixView X,
+                           const ConstMatrixView y)
+{
+    ThreadPool pool{1};
+    select_fittest(population, n_fittest, X, y, pool);
+}
+
+inline void select_fittest(std::vector<Model>& population,
+                           const std::size_t n_fittest,
+                           const std::vector<std::vector<float>>& X,
+                           const std::vector<std::vector<float>>& y)
+{
+    select_fittest(population, n_fittest, to_matrix(X), to_matrix(y));
 }
 
 inline void reproduce(std::vector<Model>& population,
@@ -118,6 +270,71 @@ inline void reproduce(std::vector<Model>& population,
     }
 }
 
+// Appends one child per parent of the first even number of individuals, each
+// pair of children crossed over and both mutated, drawing from random_engine
+// in the same order as for models.
+inline void reproduce(Population& population,
+                      const float crossover_ratio,
+                      const float mutate_ratio,
+                      const float mutate_sigma,
+                      init::RandomEngine& random_engine)
+{
+    const auto n_parents = population.size() - population.size() % 2;
+    const auto n_weights = population.get_weight_count();
+    for (std::size_t i = 0; i < n_parents; i += 2)
+    {
+        const auto child1 = population.duplicate(i);
+        const auto child2 = population.duplicate(i + 1);
+        crossover(population.get_genome(child1), population.get_genome(child2), n_weights,
+                  crossover_ratio, random_engine);
+        mutate(population.get_genome(child1), n_weights, mutate_ratio, mutate_sigma, random_engine);
+        mutate(population.get_genome(child2), n_weights, mutate_ratio, mutate_sigma, random_engine);
+    }
+}
+
+// The same with the counter-based operators, which process the pairs in
+// parallel with the same result for any thread count.
+inline void reproduce(Population& population,
+                      const float crossover_ratio,
+                      const float mutate_ratio,
+                      const float mutate_sigma,
+                      const init::Philox& philox,
+                      const std::size_t generation,
+                      ThreadPool& pool)
+{
+    const auto n_parents = population.size() - population.size() % 2;
+    for (std::size_t i = 0; i < n_parents; ++i)
+    {
+        population.duplicate(i);
+    }
+    const auto first_child = population.size() - n_parents;
+    const auto n_weights = population.get_weight_count();
+    pool.parallel_for(n_parents / 2, [&](const std::size_t pair, std::size_t)
+    {
+        float* child1 = population.get_genome(first_child + 2 * pair);
+        float* child2 = population.get_genome(first_child + 2 * pair + 1);
+        crossover(child1, child2, n_weights, crossover_ratio, philox, generation, pair);
+        mutate(child1, n_weights, mutate_ratio, mutate_sigma, philox, generation, 2 * pair);
+        mutate(child2, n_weights, mutate_ratio, mutate_sigma, philox, generation, 2 * pair + 1);
+    });
+}
+
+// the individuals of the population as models with the given losses
+inline std::vector<Model> make_models(const Population& population,
+                                      const std::vector<float>& losses)
+{
+    assert(losses.size() == population.size());
+    std::vector<Model> models;
+    for (std::size_t i = 0; i < population.size(); ++i)
+    {
+        models.push_back({losses[i], population.get_network(i)});
+    }
+    return models;
+}
+
+// Evolves population_size / 2 networks over n_generations. The individuals
+// stay in one Population, each generation appends the children and keeps
+// the fittest half of the parents and children.
 inline std::vector<Model> ga_optimize(const std::size_t n_generations,
                                       const std::size_t population_size,
                                       const float crossover_ratio,
@@ -125,21 +342,89 @@ inline std::vector<Model> ga_optimize(const std::size_t n_generations,
                                       const float mutate_sigma,
                                       const TargetType target_type,
                                       const std::vector<size_t>& layers,
-                                      const std::vector<std::vector<float>>& X,
-                                      const std::vector<std::vector<float>>& y,
-                                      init::RandomEngine& random_engine)
+                                      const ConstMatrixView X,
+                                      const ConstMatrixView y,
+                                      init::RandomEngine& random_engine,
+                                      ThreadPool& pool,
+                                      const transfer::Precision precision = transfer::Precision::Exact)
 {
     const auto n_fittest = population_size / 2;
-    auto population = gmlp::make_population(n_fittest, target_type, layers, random_engine);
+    Population population{std::make_shared<const Topology>(target_type, layers), n_fittest, random_engine, precision};
+    std::vector<float> losses(population.size(), -1.0f);
     for (std::size_t g = 0; g < n_generations; ++g)
     {
         gmlp::reproduce(population, crossover_ratio, mutate_ratio, mutate_sigma, random_engine);
         std::cout << "generation: " << g << std::endl;
         std::cout << "population size: " << population.size() << std::endl;
-        gmlp::select_fittest(population, n_fittest, X, y);
-        std::cout << "lowest loss: " << population.front().loss << std::endl;
+        losses = gmlp::select_fittest(population, n_fittest, X, y, pool);
+        std::cout << "lowest loss: " << losses.front() << std::endl;
     }
-    return population;
+    return make_models(population, losses);
+}
+
+// The same with the counter-based generator seeded by seed, which lets the
+// pool run the initialization and reproduction as well as the fitness
+// evaluation. The result only depends on the seed, not on the thread count.
+inline std::vector<Model> ga_optimize(const std::size_t n_generations,
+                                      const std::size_t population_size,
+                                      const float crossover_ratio,
+                                      const float mutate_ratio,
+                                      const float mutate_sigma,
+                                      const TargetType target_type,
+                                      const std::vector<size_t>& layers,
+                                      const ConstMatrixView X,
+                                      const ConstMatrixView y,
+                                      const std::uint64_t seed,
+                                      ThreadPool& pool,
+                                      const transfer::Precision precision = transfer::Precision::Exact)
+{
+    const auto n_fittest = population_size / 2;
+    const init::Philox philox{seed};
+    Population population{std::make_shared<const Topology>(target_type, layers), n_fittest, philox, pool, precision};
+    std::vector<float> losses(population.size(), -1.0f);
+    for (std::size_t g = 0; g < n_generations; ++g)
+    {
+        gmlp::reproduce(population, crossover_ratio, mutate_ratio, mutate_sigma, philox, g, pool);
+        std::cout << "generation: " << g << std::endl;
+        std::cout << "population size: " << population.size() << std::endl;
+        losses = gmlp::select_fittest(population, n_fittest, X, y, pool);
+        std::cout << "lowest loss: " << losses.front() << std::endl;
+    }
+    return make_models(population, losses);
+}
+
+// the same with one thread per core for the fitness evaluation
+inline std::vector<Model> ga_optimize(const std::size_t n_generations,
+                                      const std::size_t population_size,
+                                      const float crossover_ratio,
+                                      const float mutate_ratio,
+                                      const float mutate_sigma,
+                                      const TargetType target_type,
+                                      const std::vector<size_t>& layers,
+                                      const ConstMatrixView X,
+                                      const ConstMatrixView y,
+                                      init::RandomEngine& random_engine,
+                                      const transfer::Precision precision = transfer::Precision::Exact)
+{
+    ThreadPool pool;
+    return ga_optimize(n_generations, population_size, crossover_ratio, mutate_ratio, mutate_sigma,
+                       target_type, layers, X, y, random_engine, pool, precision);
+}
+
+inline std::vector<Model> ga_optimize(const std::size_t n_generations,
+                                      const std::size_t population_size,
+                                      const float crossover_ratio,
+                                      const float mutate_ratio,
+                                      const float mutate_sigma,
+                                      const TargetType target_type,
+                                      const std::vector<size_t>& layers,
+                                      const std::vector<std::vector<float>>& X,
+                                      const std::vector<std::vector<float>>& y,
+                                      init::RandomEngine& random_engine,
+                                      const transfer::Precision precision = transfer::Precision::Exact)
+{
+    return ga_optimize(n_generations, population_size, crossover_ratio, mutate_ratio, mutate_sigma,
+                       target_type, layers, to_matrix(X), to_matrix(y), random_engine, precision);
 }
 
 }
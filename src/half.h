@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include "kernels.h"
+
+namespace gmlp
+{
+
+// Element types of datasets and stored weights
+enum class DataType : std::uint32_t
+{
+    Float32,
+    BFloat16,
+    Float16,
+};
+
+// 16-bit storage types which hold a float rounded to nearest even. They only
+// store values, all arithmetic converts them to float first.
+class bfloat16
+{
+public:
+    bfloat16() = default;
+
+    explicit
+    bfloat16(const float value)
+        : bits_{kernels::detail::float_to_bf16_bits(value)}
+    {}
+
+    explicit operator float() const
+    {
+        return kernels::detail::bf16_bits_to_float(bits_);
+    }
+
+private:
+    std::uint16_t bits_;
+};
+
+class float16
+{
+public:
+    float16() = default;
+
+    explicit
+    float16(const float value)
+        : bits_{kernels::detail::float_to_fp16_bits(value)}
+    {}
+
+    explicit operator float() const
+    {
+        return kernels::detail::fp16_bits_to_float(bits_);
+    }
+
+private:
+    std::uint16_t bits_;
+};
+
+static_assert(sizeof(bfloat16) == 2 && sizeof(float16) == 2, "16-bit types must not be padded");
+
+template<typename T>
+constexpr DataType get_data_type()
+{
+    static_assert(std::is_same<T, float>::value || std::is_same<T, bfloat16>::value
+                  || std::is_same<T, float16>::value, "unsupported element type");
+    return std::is_same<T, float>::value ? DataType::Float32
+         : std::is_same<T, bfloat16>::value ? DataType::BFloat16
+                                            : DataType::Float16;
+}
+
+inline std::size_t get_size(const DataType data_type)
+{
+    return data_type == DataType::Float32 ? sizeof(float) : sizeof(std::uint16_t);
+}
+
+// converts n values to or from float, widening uses the SIMD kernels
+inline void convert(const float* x,
+                    float* y,
+                    const std::size_t n)
+{
+    std::copy(x, x + n, y);
+}
+
+inline void convert(const bfloat16* x,
+                    float* y,
+                    const std::size_t n)
+{
+    kernels::bf16_to_float(reinterpret_cast<const std::uint16_t*>(x), y, n);
+}
+
+inline void convert(const float16* x,
+                    float* y,
+                    const std::size_t n)
+{
+    kernels::fp16_to_float(reinterpret_cast<const std::uint16_t*>(x), y, n);
+}
+
+// y[m] = A[m x n] * x[n] in float for A stored as any of the types
+inline void gemv(const std::size_t m,
+                 const std::size_t n,
+                 const float* A,
+                 const std::size_t lda,
+                 const float* x,
+                 float* y)
+{
+    kernels::gemv(m, n, A, lda, x, y);
+}
+
+inline void gemv(const std::size_t m,
+                 const std::size_t n,
+                 const bfloat16* A,
+                 const std::size_t lda,
+                 const float* x,
+                 float* y)
+{
+    kernels::gemv_bf16(m, n, reinterpret_cast<const std::uint16_t*>(A), lda, x, y);
+}
+
+inline void gemv(const std::size_t m,
+                 const std::size_t n,
+                 const float16* A,
+                 const std::size_t lda,
+                 const float* x,
+                 float* y)
+{
+    kernels::gemv_fp16(m, n, reinterpret_cast<const std::uint16_t*>(A), lda, x, y);
+}
+
+template<typename T>
+void convert(const float* x,
+             T* y,
+             const std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        y[i] = T(x[i]);
+    }
+}
+
+}
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <random>
 
 namespace gmlp
@@ -52,6 +56,93 @@ inline void xavier(RandomEngine& random_engine,
     }
 }
 
+// The counter-based Philox4x32-10 generator of Salmon et al., "Parallel
+// random numbers: as easy as 1, 2, 3". It maps a 128-bit counter to four
+// random 32-bit values under a 64-bit key, the seed. Every value is a pure
+// function of the seed and its counter, so threads and SIMD lanes can draw
+// numbers for any counter independently and in any order with the same
+// result. Callers address numbers as (index, individual, generation,
+// stream) and use distinct streams for distinct purposes.
+class Philox
+{
+public:
+    using Counter = std::array<std::uint32_t, 4>;
+
+    explicit
+    Philox(const std::uint64_t seed)
+        : key_{static_cast<std::uint32_t>(seed), static_cast<std::uint32_t>(seed >> 32)}
+    {}
+
+    Counter operator()(Counter counter) const
+    {
+        auto key = key_;
+        for (int round = 0; round < 10; ++round)
+        {
+            const auto product0 = std::uint64_t{0xd2511f53} * counter[0];
+            const auto product1 = std::uint64_t{0xcd9e8d57} * counter[2];
+            counter = {static_cast<std::uint32_t>(product1 >> 32) ^ counter[1] ^ key[0],
+                       static_cast<std::uint32_t>(product1),
+                       static_cast<std::uint32_t>(product0 >> 32) ^ counter[3] ^ key[1],
+                       static_cast<std::uint32_t>(product0)};
+            key[0] += 0x9e3779b9;
+            key[1] += 0xbb67ae85;
+        }
+        return counter;
+    }
+
+    Counter operator()(const std::size_t index,
+                       const std::size_t individual,
+                       const std::size_t generation,
+                       const std::uint32_t stream) const
+    {
+        return (*this)({static_cast<std::uint32_t>(index), static_cast<std::uint32_t>(individual),
+                        static_cast<std::uint32_t>(generation), stream});
+    }
+
+    // a uniform float in (0, 1) from 32 random bits, exact since the 23
+    // bits kept plus one half fit the significand
+    static float to_uniform(const std::uint32_t bits)
+    {
+        return (static_cast<float>(bits >> 9) + 0.5f) * 0x1p-23f;
+    }
+
+    // a standard normal float from two uniform ones (Box-Muller)
+    static float to_normal(const std::uint32_t bits1,
+                           const std::uint32_t bits2)
+    {
+        const auto radius = std::sqrt(-2.0f * std::log(to_uniform(bits1)));
+        return radius * std::cos(6.283185307f * to_uniform(bits2));
+    }
+
+private:
+    std::array<std::uint32_t, 2> key_;
+};
+
+// streams of the Philox numbers drawn by the library
+enum Stream : std::uint32_t
+{
+    Initialization,
+    Crossover,
+    Mutation,
+};
+
+// The counter-based xavier initialization of the n weights of one neuron of
+// an individual. The weights are numbered from first, their index in the
+// genome, so the neurons can be initialized in any order.
+inline void xavier(const Philox& philox,
+                   const std::size_t individual,
+                   const std::size_t first,
+                   float* weights,
+                   const std::size_t n)
+{
+    const auto sigma = 1.0f / static_cast<float>(n - 1); // bias not included
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        const auto bits = philox(first + i, individual, 0, Stream::Initialization);
+        weights[i] = sigma * Philox::to_normal(bits[0], bits[1]);
+    }
+}
+
 }
 
 }
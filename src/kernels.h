@@ -0,0 +1,2176 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define GMLP_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define GMLP_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define GMLP_TARGET(isa) __attribute__((target(isa)))
+#else
+#define GMLP_TARGET(isa)
+#endif
+
+namespace gmlp
+{
+
+namespace kernels
+{
+
+// The instruction set used by the kernels. It is selected once on first use
+// from cpuid and can be lowered by setting the environment variable GMLP_ISA
+// to one of scalar, sse2, avx2, avx512 or neon.
+enum class Isa
+{
+    Scalar,
+    SSE2,
+    AVX2,
+    AVX512,
+    NEON,
+};
+
+inline const char* isa_name(const Isa isa)
+{
+    switch (isa)
+    {
+        case Isa::Scalar: return "scalar";
+        case Isa::SSE2: return "sse2";
+        case Isa::AVX2: return "avx2";
+        case Isa::AVX512: return "avx512";
+        case Isa::NEON: return "neon";
+    }
+    return "unknown";
+}
+
+// Accuracy of the exp, sigmoid and tanh kernels. Exact uses the standard
+// library, High and Low use a polynomial for exp after range reduction and
+// stay within an absolute error of about 1e-6 and 1e-3 for sigmoid and tanh.
+enum class Precision
+{
+    Exact,
+    High,
+    Low,
+};
+
+// Hyperparameters of the fused optimizer steps. The gradients are multiplied
+// by gradient_scale first, e.g. to average gradients summed over a batch.
+struct StepParams
+{
+    float learning_rate = 0.0f;
+    float gradient_scale = 1.0f;
+    // momentum or decay rate of the first moment
+    float beta1 = 0.0f;
+    // decay rate of the second moment
+    float beta2 = 0.0f;
+    float epsilon = 0.0f;
+    // weights are multiplied by 1 - decay, decoupled from the gradient
+    float decay = 0.0f;
+    bool nesterov = false;
+};
+
+namespace detail
+{
+
+// constants of the exp approximation: exp(x) = 2^n * exp(r) with
+// r = x - n * ln(2) split into a high and low part for accuracy
+constexpr float exp_min = -87.0f;
+constexpr float exp_max = 88.0f;
+constexpr float log2e = 1.44269504088896341f;
+constexpr float ln2_hi = 0.693359375f;
+constexpr float ln2_lo = -2.12194440e-4f;
+// exp(r) = 1 + r + r^2 * p(r) on [-ln(2)/2, ln(2)/2] for Precision::High
+constexpr float exp_p0 = 1.9875691500e-4f;
+constexpr float exp_p1 = 1.3981999507e-3f;
+constexpr float exp_p2 = 8.3334519073e-3f;
+constexpr float exp_p3 = 4.1665795894e-2f;
+constexpr float exp_p4 = 1.6666665459e-1f;
+constexpr float exp_p5 = 5.0000001201e-1f;
+// exp(r) = 1 + r + r^2 / 2 + r^3 / 6 for Precision::Low
+constexpr float exp_q0 = 1.0f / 6.0f;
+constexpr float exp_q1 = 0.5f;
+
+struct KernelTable
+{
+    Isa isa;
+    // x . y
+    float (*dot)(const float* x, const float* y, std::size_t n);
+    // y += a * x
+    void (*axpy)(float a, const float* x, float* y, std::size_t n);
+    // y[m] = A[m x n] * x
+    void (*gemv)(std::size_t m, std::size_t n, const float* A, std::size_t lda, const float* x, float* y);
+    // C[m x n] = A[m x k] * B[n x k]^T with B packed by pack_nt
+    void (*gemm_packed)(std::size_t m, std::size_t n, std::size_t k,
+                        const float* A, std::size_t lda, const float* packed, float* C, std::size_t ldc);
+    // in place approximations, never called with Precision::Exact
+    void (*exp)(float* x, std::size_t n, Precision precision);
+    void (*sigmoid)(float* x, std::size_t n, Precision precision);
+    void (*tanh)(float* x, std::size_t n, Precision precision);
+    // fused optimizer steps updating the n weights w with the gradients g and
+    // the optimizer state v, s or m and v in place
+    void (*momentum)(float* w, float* v, const float* g, std::size_t n, const StepParams& params);
+    void (*rmsprop)(float* w, float* s, const float* g, std::size_t n, const StepParams& params);
+    void (*adam)(float* w, float* m, float* v, const float* g, std::size_t n, const StepParams& params);
+    // y = x for x stored as the upper 16 bits of a float or as IEEE half
+    void (*bf16_to_float)(const std::uint16_t* x, float* y, std::size_t n);
+    void (*fp16_to_float)(const std::uint16_t* x, float* y, std::size_t n);
+    // gemv with A stored as bfloat16 or half, accumulating in float
+    void (*gemv_bf16)(std::size_t m, std::size_t n, const std::uint16_t* A, std::size_t lda,
+                      const float* x, float* y);
+    void (*gemv_fp16)(std::size_t m, std::size_t n, const std::uint16_t* A, std::size_t lda,
+                      const float* x, float* y);
+    // y[m] = A[m x n] * x[n] for signed 8-bit A and unsigned 8-bit x with
+    // exact 32-bit accumulation
+    void (*gemv_u8s8)(std::size_t m, std::size_t n, const std::int8_t* A, std::size_t lda,
+                      const std::uint8_t* x, std::int32_t* y);
+};
+
+// B^T packed for gemm_packed: a k x packed_width(n) row-major matrix whose
+// width is a multiple of the widest register tile, padded with zeros
+constexpr std::size_t pack_tile = 32;
+
+inline std::size_t packed_width(const std::size_t n)
+{
+    return (n + pack_tile - 1) / pack_tile * pack_tile;
+}
+
+template<typename T>
+void pack_nt(const T* B,
+             const std::size_t ldb,
+             const std::size_t n,
+             const std::size_t k,
+             float* packed)
+{
+    const auto width = packed_width(n);
+    for (std::size_t p = 0; p < k; ++p)
+    {
+        float* row = packed + p * width;
+        for (std::size_t j = 0; j < n; ++j)
+        {
+            row[j] = static_cast<float>(B[j * ldb + p]);
+        }
+        std::fill(row + n, row + width, 0.0f);
+    }
+}
+
+// packs B[k x n] into the layout of pack_nt, whose packed rows are the
+// rows of B
+inline void pack_nn(const float* B,
+                    const std::size_t ldb,
+                    const std::size_t n,
+                    const std::size_t k,
+                    float* packed)
+{
+    const auto width = packed_width(n);
+    for (std::size_t p = 0; p < k; ++p)
+    {
+        float* row = packed + p * width;
+        std::copy(B + p * ldb, B + p * ldb + n, row);
+        std::fill(row + n, row + width, 0.0f);
+    }
+}
+
+// gemm_packed as a sequence of axpy's of the packed rows into each row of C
+inline void gemm_packed_by_rows(void (*axpy)(float, const float*, float*, std::size_t),
+                                const std::size_t m,
+                                const std::size_t n,
+                                const std::size_t k,
+                                const float* A,
+                                const std::size_t lda,
+                                const float* packed,
+                                float* C,
+                                const std::size_t ldc)
+{
+    const auto width = packed_width(n);
+    for (std::size_t i = 0; i < m; ++i)
+    {
+        float* row = C + i * ldc;
+        std::fill(row, row + n, 0.0f);
+        for (std::size_t p = 0; p < k; ++p)
+        {
+            axpy(A[i * lda + p], packed + p * width, row, n);
+        }
+    }
+}
+
+// bfloat16 keeps the upper 16 bits of a float, rounded to nearest even
+inline std::uint16_t float_to_bf16_bits(const float value)
+{
+    std::uint32_t x;
+    std::memcpy(&x, &value, sizeof(x));
+    if ((x & 0x7fffffffu) > 0x7f800000u)
+    {
+        return static_cast<std::uint16_t>((x >> 16) | 0x40u); // quiet NaN
+    }
+    x += 0x7fffu + ((x >> 16) & 1u);
+    return static_cast<std::uint16_t>(x >> 16);
+}
+
+inline float bf16_bits_to_float(const std::uint16_t bits)
+{
+    const std::uint32_t x = static_cast<std::uint32_t>(bits) << 16;
+    float value;
+    std::memcpy(&value, &x, sizeof(value));
+    return value;
+}
+
+// IEEE half precision, rounded to nearest even
+inline std::uint16_t float_to_fp16_bits(const float value)
+{
+    std::uint32_t x;
+    std::memcpy(&x, &value, sizeof(x));
+    const auto sign = static_cast<std::uint16_t>((x >> 16) & 0x8000u);
+    x &= 0x7fffffffu;
+    if (x > 0x7f800000u)
+    {
+        return static_cast<std::uint16_t>(sign | 0x7e00u); // quiet NaN
+    }
+    if (x >= 0x477ff000u)
+    {
+        return static_cast<std::uint16_t>(sign | 0x7c00u); // rounds to infinity
+    }
+    if (x < 0x38800000u)
+    {
+        // subnormal, in units of 2^-24
+        return static_cast<std::uint16_t>(sign | static_cast<std::uint16_t>(std::nearbyint(std::abs(value) * 16777216.0f)));
+    }
+    x += 0xfffu + ((x >> 13) & 1u);
+    return static_cast<std::uint16_t>(sign | ((x - 0x38000000u) >> 13));
+}
+
+// Moves exponent and mantissa into place and rebiases the exponent by
+// multiplying with 2^112, which also handles subnormals. Infinity and NaN
+// get the maximum exponent.
+inline float fp16_bits_to_float(const std::uint16_t bits)
+{
+    const std::uint32_t magnitude = static_cast<std::uint32_t>(bits & 0x7fffu) << 13;
+    float value;
+    if ((bits & 0x7c00u) == 0x7c00u)
+    {
+        const std::uint32_t x = magnitude | 0x7f800000u;
+        std::memcpy(&value, &x, sizeof(value));
+    }
+    else
+    {
+        std::memcpy(&value, &magnitude, sizeof(value));
+        value *= 5.192296858534828e33f; // 2^112
+    }
+    return (bits & 0x8000u) ? -value : value;
+}
+
+namespace scalar
+{
+
+inline float dot(const float* x,
+                 const float* y,
+                 const std::size_t n)
+{
+    float result = 0.0f;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        result += x[i] * y[i];
+    }
+    return result;
+}
+
+inline void axpy(const float a,
+                 const float* x,
+                 float* y,
+                 const std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        y[i] += a * x[i];
+    }
+}
+
+inline void gemv(const std::size_t m,
+                 const std::size_t n,
+                 const float* A,
+                 const std::size_t lda,
+                 const float* x,
+                 float* y)
+{
+    for (std::size_t i = 0; i < m; ++i)
+    {
+        y[i] = dot(A + i * lda, x, n);
+    }
+}
+
+inline void gemm_packed(const std::size_t m,
+                        const std::size_t n,
+                        const std::size_t k,
+                        const float* A,
+                        const std::size_t lda,
+                        const float* packed,
+                        float* C,
+                        const std::size_t ldc)
+{
+    gemm_packed_by_rows(axpy, m, n, k, A, lda, packed, C, ldc);
+}
+
+inline float exp_approx(float x,
+                        const Precision precision)
+{
+    x = std::min(std::max(x, exp_min), exp_max);
+    const float n = std::floor(x * log2e + 0.5f);
+    const float r = x - n * ln2_hi - n * ln2_lo;
+    float p;
+    if (precision == Precision::Low)
+    {
+        p = 1.0f + r * (1.0f + r * (exp_q1 + r * exp_q0));
+    }
+    else
+    {
+        p = exp_p0;
+        p = p * r + exp_p1;
+        p = p * r + exp_p2;
+        p = p * r + exp_p3;
+        p = p * r + exp_p4;
+        p = p * r + exp_p5;
+        p = 1.0f + r + r * r * p;
+    }
+    const std::int32_t bits = (static_cast<std::int32_t>(n) + 127) << 23;
+    float scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+
+inline float sigmoid_approx(const float x,
+                            const Precision precision)
+{
+    return 1.0f / (1.0f + exp_approx(-x, precision));
+}
+
+inline void exp(float* x,
+                const std::size_t n,
+                const Precision precision)
+{
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        x[i] = exp_approx(x[i], precision);
+    }
+}
+
+inline void sigmoid(float* x,
+                    const std::size_t n,
+                    const Precision precision)
+{
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        x[i] = sigmoid_approx(x[i], precision);
+    }
+}
+
+// tanh(x) = 2 * sigmoid(2 * x) - 1
+inline void tanh(float* x,
+                 const std::size_t n,
+                 const Precision precision)
+{
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        x[i] = 2.0f * sigmoid_approx(2.0f * x[i], precision) - 1.0f;
+    }
+}
+
+inline void momentum(float* w,
+                     float* v,
+                     const float* g,
+                     const std::size_t n,
+                     const StepParams& params)
+{
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        const float gi = g[i] * params.gradient_scale;
+        v[i] = params.beta1 * v[i] + gi;
+        w[i] -= params.learning_rate * (params.nesterov ? gi + params.beta1 * v[i] : v[i]);
+    }
+}
+
+inline void rmsprop(float* w,
+                    float* s,
+                    const float* g,
+                    const std::size_t n,
+                    const StepParams& params)
+{
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        const float gi = g[i] * params.gradient_scale;
+        s[i] = params.beta2 * s[i] + (1.0f - params.beta2) * gi * gi;
+        w[i] -= params.learning_rate * gi / (std::sqrt(s[i]) + params.epsilon);
+    }
+}
+
+inline void adam(float* w,
+                 float* m,
+                 float* v,
+                 const float* g,
+                 const std::size_t n,
+                 const StepParams& params)
+{
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        const float gi = g[i] * params.gradient_scale;
+        m[i] = params.beta1 * m[i] + (1.0f - params.beta1) * gi;
+        v[i] = params.beta2 * v[i] + (1.0f - params.beta2) * gi * gi;
+        w[i] -= params.decay * w[i] + params.learning_rate * m[i] / (std::sqrt(v[i]) + params.epsilon);
+    }
+}
+
+inline void bf16_to_float(const std::uint16_t* x,
+                          float* y,
+                          const std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        y[i] = bf16_bits_to_float(x[i]);
+    }
+}
+
+inline void fp16_to_float(const std::uint16_t* x,
+                          float* y,
+                          const std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        y[i] = fp16_bits_to_float(x[i]);
+    }
+}
+
+template<float (*widen)(std::uint16_t)>
+void gemv_widen(const std::size_t m,
+                const std::size_t n,
+                const std::uint16_t* A,
+                const std::size_t lda,
+                const float* x,
+                float* y)
+{
+    for (std::size_t i = 0; i < m; ++i)
+    {
+        const std::uint16_t* a = A + i * lda;
+        float result = 0.0f;
+        for (std::size_t j = 0; j < n; ++j)
+        {
+            result += widen(a[j]) * x[j];
+        }
+        y[i] = result;
+    }
+}
+
+inline void gemv_bf16(const std::size_t m,
+                      const std::size_t n,
+                      const std::uint16_t* A,
+                      const std::size_t lda,
+                      const float* x,
+                      float* y)
+{
+    gemv_widen<bf16_bits_to_float>(m, n, A, lda, x, y);
+}
+
+inline void gemv_fp16(const std::size_t m,
+                      const std::size_t n,
+                      const std::uint16_t* A,
+                      const std::size_t lda,
+                      const float* x,
+                      float* y)
+{
+    gemv_widen<fp16_bits_to_float>(m, n, A, lda, x, y);
+}
+
+inline void gemv_u8s8(const std::size_t m,
+                      const std::size_t n,
+                      const std::int8_t* A,
+                      const std::size_t lda,
+                      const std::uint8_t* x,
+                      std::int32_t* y)
+{
+    for (std::size_t i = 0; i < m; ++i)
+    {
+        const std::int8_t* a = A + i * lda;
+        std::int32_t result = 0;
+        for (std::size_t j = 0; j < n; ++j)
+        {
+            result += static_cast<std::int32_t>(a[j]) * static_cast<std::int32_t>(x[j]);
+        }
+        y[i] = result;
+    }
+}
+
+}
+
+#ifdef GMLP_X86
+
+namespace sse2
+{
+
+GMLP_TARGET("sse2")
+inline float hsum(const __m128 v)
+{
+    const __m128 high = _mm_movehl_ps(v, v);
+    const __m128 sum2 = _mm_add_ps(v, high);
+    const __m128 sum1 = _mm_add_ss(sum2, _mm_shuffle_ps(sum2, sum2, 1));
+    return _mm_cvtss_f32(sum1);
+}
+
+GMLP_TARGET("sse2")
+inline float dot(const float* x,
+                 const float* y,
+                 const std::size_t n)
+{
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(x + i + 4), _mm_loadu_ps(y + i + 4)));
+    }
+    for (; i + 4 <= n; i += 4)
+    {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i)));
+    }
+    float result = hsum(_mm_add_ps(acc0, acc1));
+    for (; i < n; ++i)
+    {
+        result += x[i] * y[i];
+    }
+    return result;
+}
+
+GMLP_TARGET("sse2")
+inline void axpy(const float a,
+                 const float* x,
+                 float* y,
+                 const std::size_t n)
+{
+    const __m128 va = _mm_set1_ps(a);
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(va, _mm_loadu_ps(x + i))));
+    }
+    for (; i < n; ++i)
+    {
+        y[i] += a * x[i];
+    }
+}
+
+GMLP_TARGET("sse2")
+inline void gemv(const std::size_t m,
+                 const std::size_t n,
+                 const float* A,
+                 const std::size_t lda,
+                 const float* x,
+                 float* y)
+{
+    for (std::size_t i = 0; i < m; ++i)
+    {
+        y[i] = dot(A + i * lda, x, n);
+    }
+}
+
+inline void gemm_packed(const std::size_t m,
+                        const std::size_t n,
+                        const std::size_t k,
+                        const float* A,
+                        const std::size_t lda,
+                        const float* packed,
+                        float* C,
+                        const std::size_t ldc)
+{
+    gemm_packed_by_rows(axpy, m, n, k, A, lda, packed, C, ldc);
+}
+
+}
+
+namespace avx2
+{
+
+GMLP_TARGET("avx2,fma")
+inline float hsum(const __m256 v)
+{
+    const __m128 sum4 = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    const __m128 sum2 = _mm_add_ps(sum4, _mm_movehl_ps(sum4, sum4));
+    const __m128 sum1 = _mm_add_ss(sum2, _mm_shuffle_ps(sum2, sum2, 1));
+    return _mm_cvtss_f32(sum1);
+}
+
+GMLP_TARGET("avx2,fma")
+inline float dot(const float* x,
+                 const float* y,
+                 const std::size_t n)
+{
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8), acc1);
+    }
+    for (; i + 8 <= n; i += 8)
+    {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), acc0);
+    }
+    float result = hsum(_mm256_add_ps(acc0, acc1));
+    for (; i < n; ++i)
+    {
+        result += x[i] * y[i];
+    }
+    return result;
+}
+
+GMLP_TARGET("avx2,fma")
+inline void axpy(const float a,
+                 const float* x,
+                 float* y,
+                 const std::size_t n)
+{
+    const __m256 va = _mm256_set1_ps(a);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        _mm256_storeu_ps(y + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+    }
+    for (; i < n; ++i)
+    {
+        y[i] += a * x[i];
+    }
+}
+
+// four rows at a time so that every load of x is shared by four rows of A
+GMLP_TARGET("avx2,fma")
+inline void gemv(const std::size_t m,
+                 const std::size_t n,
+                 const float* A,
+                 const std::size_t lda,
+                 const float* x,
+                 float* y)
+{
+    std::size_t i = 0;
+    for (; i + 4 <= m; i += 4)
+    {
+        const float* a0 = A + i * lda;
+        const float* a1 = a0 + lda;
+        const float* a2 = a1 + lda;
+        const float* a3 = a2 + lda;
+        __m256 acc0 = _mm256_setzero_ps();
+        __m256 acc1 = _mm256_setzero_ps();
+        __m256 acc2 = _mm256_setzero_ps();
+        __m256 acc3 = _mm256_setzero_ps();
+        std::size_t j = 0;
+        for (; j + 8 <= n; j += 8)
+        {
+            const __m256 vx = _mm256_loadu_ps(x + j);
+            acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a0 + j), vx, acc0);
+            acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a1 + j), vx, acc1);
+            acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(a2 + j), vx, acc2);
+            acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(a3 + j), vx, acc3);
+        }
+        float y0 = hsum(acc0);
+        float y1 = hsum(acc1);
+        float y2 = hsum(acc2);
+        float y3 = hsum(acc3);
+        for (; j < n; ++j)
+        {
+            y0 += a0[j] * x[j];
+            y1 += a1[j] * x[j];
+            y2 += a2[j] * x[j];
+            y3 += a3[j] * x[j];
+        }
+        y[i] = y0;
+        y[i + 1] = y1;
+        y[i + 2] = y2;
+        y[i + 3] = y3;
+    }
+    for (; i < m; ++i)
+    {
+        y[i] = dot(A + i * lda, x, n);
+    }
+}
+
+// 4 x 16 register tile: C[4 x 16] = A[4 x k] * panel[k x 16]. Rows past m
+// repeat the last valid row and are not stored.
+GMLP_TARGET("avx2,fma")
+inline void gemm_tile(const std::size_t rows,
+                      const std::size_t cols,
+                      const std::size_t k,
+                      const float* A,
+                      const std::size_t lda,
+                      const float* panel,
+                      const std::size_t width,
+                      float* C,
+                      const std::size_t ldc)
+{
+    const float* a0 = A;
+    const float* a1 = rows > 1 ? a0 + lda : a0;
+    const float* a2 = rows > 2 ? a1 + lda : a1;
+    const float* a3 = rows > 3 ? a2 + lda : a2;
+    __m256 c00 = _mm256_setzero_ps();
+    __m256 c01 = _mm256_setzero_ps();
+    __m256 c10 = _mm256_setzero_ps();
+    __m256 c11 = _mm256_setzero_ps();
+    __m256 c20 = _mm256_setzero_ps();
+    __m256 c21 = _mm256_setzero_ps();
+    __m256 c30 = _mm256_setzero_ps();
+    __m256 c31 = _mm256_setzero_ps();
+    for (std::size_t p = 0; p < k; ++p)
+    {
+        const __m256 b0 = _mm256_loadu_ps(panel + p * width);
+        const __m256 b1 = _mm256_loadu_ps(panel + p * width + 8);
+        __m256 va = _mm256_broadcast_ss(a0 + p);
+        c00 = _mm256_fmadd_ps(va, b0, c00);
+        c01 = _mm256_fmadd_ps(va, b1, c01);
+        va = _mm256_broadcast_ss(a1 + p);
+        c10 = _mm256_fmadd_ps(va, b0, c10);
+        c11 = _mm256_fmadd_ps(va, b1, c11);
+        va = _mm256_broadcast_ss(a2 + p);
+        c20 = _mm256_fmadd_ps(va, b0, c20);
+        c21 = _mm256_fmadd_ps(va, b1, c21);
+        va = _mm256_broadcast_ss(a3 + p);
+        c30 = _mm256_fmadd_ps(va, b0, c30);
+        c31 = _mm256_fmadd_ps(va, b1, c31);
+    }
+    alignas(32) float tile[4][16];
+    _mm256_store_ps(tile[0], c00);
+    _mm256_store_ps(tile[0] + 8, c01);
+    _mm256_store_ps(tile[1], c10);
+    _mm256_store_ps(tile[1] + 8, c11);
+    _mm256_store_ps(tile[2], c20);
+    _mm256_store_ps(tile[2] + 8, c21);
+    _mm256_store_ps(tile[3], c30);
+    _mm256_store_ps(tile[3] + 8, c31);
+    for (std::size_t r = 0; r < rows; ++r)
+    {
+        std::memcpy(C + r * ldc, tile[r], cols * sizeof(float));
+    }
+}
+
+GMLP_TARGET("avx2,fma")
+inline void gemm_packed(const std::size_t m,
+                        const std::size_t n,
+                        const std::size_t k,
+                        const float* A,
+                        const std::size_t lda,
+                        const float* packed,
+                        float* C,
+                        const std::size_t ldc)
+{
+    constexpr std::size_t tile = 16;
+    const auto width = packed_width(n);
+    for (std::size_t i = 0; i < m; i += 4)
+    {
+        for (std::size_t j = 0; j < n; j += tile)
+        {
+            gemm_tile(std::min<std::size_t>(4, m - i), std::min(tile, n - j), k,
+                      A + i * lda, lda, packed + j, width, C + i * ldc + j, ldc);
+        }
+    }
+}
+
+GMLP_TARGET("avx2,fma")
+inline __m256 exp_approx(__m256 x,
+                         const Precision precision)
+{
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(exp_min)), _mm256_set1_ps(exp_max));
+    const __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(log2e)),
+                                     _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(ln2_hi), x);
+    r = _mm256_fnmadd_ps(n, _mm256_set1_ps(ln2_lo), r);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    __m256 p;
+    if (precision == Precision::Low)
+    {
+        p = _mm256_fmadd_ps(_mm256_set1_ps(exp_q0), r, _mm256_set1_ps(exp_q1));
+        p = _mm256_fmadd_ps(p, r, one);
+        p = _mm256_fmadd_ps(p, r, one);
+    }
+    else
+    {
+        p = _mm256_fmadd_ps(_mm256_set1_ps(exp_p0), r, _mm256_set1_ps(exp_p1));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(exp_p2));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(exp_p3));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(exp_p4));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(exp_p5));
+        p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, one));
+    }
+    const __m256i bits = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(bits));
+}
+
+// Precision::Low replaces the division by the reciprocal estimate
+GMLP_TARGET("avx2,fma")
+inline __m256 sigmoid_approx(const __m256 x,
+                             const Precision precision)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 denom = _mm256_add_ps(one, exp_approx(_mm256_sub_ps(_mm256_setzero_ps(), x), precision));
+    return precision == Precision::Low ? _mm256_rcp_ps(denom) : _mm256_div_ps(one, denom);
+}
+
+GMLP_TARGET("avx2,fma")
+inline void exp(float* x,
+                const std::size_t n,
+                const Precision precision)
+{
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        _mm256_storeu_ps(x + i, exp_approx(_mm256_loadu_ps(x + i), precision));
+    }
+    scalar::exp(x + i, n - i, precision);
+}
+
+GMLP_TARGET("avx2,fma")
+inline void sigmoid(float* x,
+                    const std::size_t n,
+                    const Precision precision)
+{
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        _mm256_storeu_ps(x + i, sigmoid_approx(_mm256_loadu_ps(x + i), precision));
+    }
+    scalar::sigmoid(x + i, n - i, precision);
+}
+
+GMLP_TARGET("avx2,fma")
+inline void tanh(float* x,
+                 const std::size_t n,
+                 const Precision precision)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 two = _mm256_set1_ps(2.0f);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256 s = sigmoid_approx(_mm256_mul_ps(two, _mm256_loadu_ps(x + i)), precision);
+        _mm256_storeu_ps(x + i, _mm256_fmsub_ps(two, s, one));
+    }
+    scalar::tanh(x + i, n - i, precision);
+}
+
+GMLP_TARGET("avx2,fma")
+inline void momentum(float* w,
+                     float* v,
+                     const float* g,
+                     const std::size_t n,
+                     const StepParams& params)
+{
+    const __m256 lr = _mm256_set1_ps(params.learning_rate);
+    const __m256 scale = _mm256_set1_ps(params.gradient_scale);
+    const __m256 beta1 = _mm256_set1_ps(params.beta1);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256 gi = _mm256_mul_ps(_mm256_loadu_ps(g + i), scale);
+        const __m256 vi = _mm256_fmadd_ps(beta1, _mm256_loadu_ps(v + i), gi);
+        const __m256 d = params.nesterov ? _mm256_fmadd_ps(beta1, vi, gi) : vi;
+        _mm256_storeu_ps(v + i, vi);
+        _mm256_storeu_ps(w + i, _mm256_fnmadd_ps(lr, d, _mm256_loadu_ps(w + i)));
+    }
+    scalar::momentum(w + i, v + i, g + i, n - i, params);
+}
+
+GMLP_TARGET("avx2,fma")
+inline void rmsprop(float* w,
+                    float* s,
+                    const float* g,
+                    const std::size_t n,
+                    const StepParams& params)
+{
+    const __m256 lr = _mm256_set1_ps(params.learning_rate);
+    const __m256 scale = _mm256_set1_ps(params.gradient_scale);
+    const __m256 beta2 = _mm256_set1_ps(params.beta2);
+    const __m256 one_minus_beta2 = _mm256_set1_ps(1.0f - params.beta2);
+    const __m256 epsilon = _mm256_set1_ps(params.epsilon);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256 gi = _mm256_mul_ps(_mm256_loadu_ps(g + i), scale);
+        const __m256 si = _mm256_fmadd_ps(beta2, _mm256_loadu_ps(s + i), _mm256_mul_ps(one_minus_beta2, _mm256_mul_ps(gi, gi)));
+        const __m256 d = _mm256_div_ps(gi, _mm256_add_ps(_mm256_sqrt_ps(si), epsilon));
+        _mm256_storeu_ps(s + i, si);
+        _mm256_storeu_ps(w + i, _mm256_fnmadd_ps(lr, d, _mm256_loadu_ps(w + i)));
+    }
+    scalar::rmsprop(w + i, s + i, g + i, n - i, params);
+}
+
+GMLP_TARGET("avx2,fma")
+inline void adam(float* w,
+                 float* m,
+                 float* v,
+                 const float* g,
+                 const std::size_t n,
+                 const StepParams& params)
+{
+    const __m256 lr = _mm256_set1_ps(params.learning_rate);
+    const __m256 scale = _mm256_set1_ps(params.gradient_scale);
+    const __m256 beta1 = _mm256_set1_ps(params.beta1);
+    const __m256 one_minus_beta1 = _mm256_set1_ps(1.0f - params.beta1);
+    const __m256 beta2 = _mm256_set1_ps(params.beta2);
+    const __m256 one_minus_beta2 = _mm256_set1_ps(1.0f - params.beta2);
+    const __m256 epsilon = _mm256_set1_ps(params.epsilon);
+    const __m256 decay = _mm256_set1_ps(params.decay);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256 gi = _mm256_mul_ps(_mm256_loadu_ps(g + i), scale);
+        const __m256 mi = _mm256_fmadd_ps(beta1, _mm256_loadu_ps(m + i), _mm256_mul_ps(one_minus_beta1, gi));
+        const __m256 vi = _mm256_fmadd_ps(beta2, _mm256_loadu_ps(v + i), _mm256_mul_ps(one_minus_beta2, _mm256_mul_ps(gi, gi)));
+        const __m256 d = _mm256_div_ps(mi, _mm256_add_ps(_mm256_sqrt_ps(vi), epsilon));
+        const __m256 wi = _mm256_loadu_ps(w + i);
+        _mm256_storeu_ps(m + i, mi);
+        _mm256_storeu_ps(v + i, vi);
+        _mm256_storeu_ps(w + i, _mm256_fnmadd_ps(lr, d, _mm256_fnmadd_ps(decay, wi, wi)));
+    }
+    scalar::adam(w + i, m + i, v + i, g + i, n - i, params);
+}
+
+// Loaders widening 8 bfloat16 or half values to float. The half loader does
+// the same as fp16_bits_to_float since F16C is not part of the AVX2
+// requirements.
+struct LoadBF16
+{
+    GMLP_TARGET("avx2,fma")
+    static __m256 load(const std::uint16_t* x)
+    {
+        const __m256i bits = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(x)));
+        return _mm256_castsi256_ps(_mm256_slli_epi32(bits, 16));
+    }
+};
+
+struct LoadFP16
+{
+    GMLP_TARGET("avx2,fma")
+    static __m256 load(const std::uint16_t* x)
+    {
+        const __m256i exponent_mask = _mm256_set1_epi32(0x7c00);
+        const __m256i bits = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(x)));
+        const __m256i magnitude = _mm256_slli_epi32(_mm256_and_si256(bits, _mm256_set1_epi32(0x7fff)), 13);
+        const __m256 finite = _mm256_mul_ps(_mm256_castsi256_ps(magnitude),
+                                            _mm256_set1_ps(5.192296858534828e33f)); // 2^112
+        const __m256 special = _mm256_castsi256_ps(_mm256_or_si256(magnitude, _mm256_set1_epi32(0x7f800000)));
+        const __m256 is_special = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(bits, exponent_mask),
+                                                                         exponent_mask));
+        const __m256 sign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(bits, _mm256_set1_epi32(0x8000)),
+                                                                  16));
+        return _mm256_or_ps(_mm256_blendv_ps(finite, special, is_special), sign);
+    }
+};
+
+GMLP_TARGET("avx2,fma")
+inline void bf16_to_float(const std::uint16_t* x,
+                          float* y,
+                          const std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        _mm256_storeu_ps(y + i, LoadBF16::load(x + i));
+    }
+    scalar::bf16_to_float(x + i, y + i, n - i);
+}
+
+GMLP_TARGET("avx2,fma")
+inline void fp16_to_float(const std::uint16_t* x,
+                          float* y,
+                          const std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        _mm256_storeu_ps(y + i, LoadFP16::load(x + i));
+    }
+    scalar::fp16_to_float(x + i, y + i, n - i);
+}
+
+// gemv of 16-bit rows, four rows at a time like gemv
+template<typename Load,
+         float (*widen)(std::uint16_t)>
+GMLP_TARGET("avx2,fma")
+void gemv_widen(const std::size_t m,
+                const std::size_t n,
+                const std::uint16_t* A,
+                const std::size_t lda,
+                const float* x,
+                float* y)
+{
+    std::size_t i = 0;
+    for (; i + 4 <= m; i += 4)
+    {
+        const std::uint16_t* a0 = A + i * lda;
+        const std::uint16_t* a1 = a0 + lda;
+        const std::uint16_t* a2 = a1 + lda;
+        const std::uint16_t* a3 = a2 + lda;
+        __m256 acc0 = _mm256_setzero_ps();
+        __m256 acc1 = _mm256_setzero_ps();
+        __m256 acc2 = _mm256_setzero_ps();
+        __m256 acc3 = _mm256_setzero_ps();
+        std::size_t j = 0;
+        for (; j + 8 <= n; j += 8)
+        {
+            const __m256 vx = _mm256_loadu_ps(x + j);
+            acc0 = _mm256_fmadd_ps(Load::load(a0 + j), vx, acc0);
+            acc1 = _mm256_fmadd_ps(Load::load(a1 + j), vx, acc1);
+            acc2 = _mm256_fmadd_ps(Load::load(a2 + j), vx, acc2);
+            acc3 = _mm256_fmadd_ps(Load::load(a3 + j), vx, acc3);
+        }
+        float y0 = hsum(acc0);
+        float y1 = hsum(acc1);
+        float y2 = hsum(acc2);
+        float y3 = hsum(acc3);
+        for (; j < n; ++j)
+        {
+            y0 += widen(a0[j]) * x[j];
+            y1 += widen(a1[j]) * x[j];
+            y2 += widen(a2[j]) * x[j];
+            y3 += widen(a3[j]) * x[j];
+        }
+        y[i] = y0;
+        y[i + 1] = y1;
+        y[i + 2] = y2;
+        y[i + 3] = y3;
+    }
+    scalar::gemv_widen<widen>(m - i, n, A + i * lda, lda, x, y + i);
+}
+
+GMLP_TARGET("avx2,fma")
+inline void gemv_bf16(const std::size_t m,
+                      const std::size_t n,
+                      const std::uint16_t* A,
+                      const std::size_t lda,
+                      const float* x,
+                      float* y)
+{
+    gemv_widen<LoadBF16, bf16_bits_to_float>(m, n, A, lda, x, y);
+}
+
+GMLP_TARGET("avx2,fma")
+inline void gemv_fp16(const std::size_t m,
+                      const std::size_t n,
+                      const std::uint16_t* A,
+                      const std::size_t lda,
+                      const float* x,
+                      float* y)
+{
+    gemv_widen<LoadFP16, fp16_bits_to_float>(m, n, A, lda, x, y);
+}
+
+GMLP_TARGET("avx2,fma")
+inline std::int32_t hsum(const __m256i v)
+{
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+    return _mm_cvtsi128_si32(sum);
+}
+
+// Widens both operands to 16 bits for madd, which unlike maddubs cannot
+// saturate. Four rows at a time like gemv.
+GMLP_TARGET("avx2,fma")
+inline void gemv_u8s8(const std::size_t m,
+                      const std::size_t n,
+                      const std::int8_t* A,
+                      const std::size_t lda,
+                      const std::uint8_t* x,
+                      std::int32_t* y)
+{
+    const auto load = [](const void* p)
+    {
+        return _mm_loadu_si128(static_cast<const __m128i*>(p));
+    };
+    std::size_t i = 0;
+    for (; i + 4 <= m; i += 4)
+    {
+        const std::int8_t* a0 = A + i * lda;
+        const std::int8_t* a1 = a0 + lda;
+        const std::int8_t* a2 = a1 + lda;
+        const std::int8_t* a3 = a2 + lda;
+        __m256i acc0 = _mm256_setzero_si256();
+        __m256i acc1 = _mm256_setzero_si256();
+        __m256i acc2 = _mm256_setzero_si256();
+        __m256i acc3 = _mm256_setzero_si256();
+        std::size_t j = 0;
+        for (; j + 16 <= n; j += 16)
+        {
+            const __m256i vx = _mm256_cvtepu8_epi16(load(x + j));
+            acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(_mm256_cvtepi8_epi16(load(a0 + j)), vx));
+            acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(_mm256_cvtepi8_epi16(load(a1 + j)), vx));
+            acc2 = _mm256_add_epi32(acc2, _mm256_madd_epi16(_mm256_cvtepi8_epi16(load(a2 + j)), vx));
+            acc3 = _mm256_add_epi32(acc3, _mm256_madd_epi16(_mm256_cvtepi8_epi16(load(a3 + j)), vx));
+        }
+        std::int32_t y0 = hsum(acc0);
+        std::int32_t y1 = hsum(acc1);
+        std::int32_t y2 = hsum(acc2);
+        std::int32_t y3 = hsum(acc3);
+        for (; j < n; ++j)
+        {
+            y0 += a0[j] * x[j];
+            y1 += a1[j] * x[j];
+            y2 += a2[j] * x[j];
+            y3 += a3[j] * x[j];
+        }
+        y[i] = y0;
+        y[i + 1] = y1;
+        y[i + 2] = y2;
+        y[i + 3] = y3;
+    }
+    scalar::gemv_u8s8(m - i, n, A + i * lda, lda, x, y + i);
+}
+
+}
+
+// GCC 12 reports the _mm512_undefined_ps() used inside many of the unmasked
+// AVX-512 intrinsics as uninitialized
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+namespace avx512
+{
+
+GMLP_TARGET("avx512f,avx2,fma")
+inline __mmask16 tail_mask(const std::size_t n)
+{
+    return static_cast<__mmask16>((1u << n) - 1u);
+}
+
+GMLP_TARGET("avx512f,avx2,fma")
+inline float hsum(const __m512 v)
+{
+    const __m256 low = _mm512_castps512_ps256(v);
+    const __m256 high = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(v), 1));
+    return avx2::hsum(_mm256_add_ps(low, high));
+}
+
+GMLP_TARGET("avx512f,avx2,fma")
+inline float dot(const float* x,
+                 const float* y,
+                 const std::size_t n)
+{
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    std::size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i + 16), _mm512_loadu_ps(y + i + 16), acc1);
+    }
+    for (; i + 16 <= n; i += 16)
+    {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i), acc0);
+    }
+    if (i < n)
+    {
+        const __mmask16 mask = tail_mask(n - i);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, x + i), _mm512_maskz_loadu_ps(mask, y + i), acc1);
+    }
+    return hsum(_mm512_add_ps(acc0, acc1));
+}
+
+GMLP_TARGET("avx512f,avx2,fma")
+inline void axpy(const float a,
+                 const float* x,
+                 float* y,
+                 const std::size_t n)
+{
+    const __m512 va = _mm512_set1_ps(a);
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        _mm512_storeu_ps(y + i, _mm512_fmadd_ps(va, _mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i)));
+    }
+    if (i < n)
+    {
+        const __mmask16 mask = tail_mask(n - i);
+        const __m512 vy = _mm512_maskz_loadu_ps(mask, y + i);
+        _mm512_mask_storeu_ps(y + i, mask, _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(mask, x + i), vy));
+    }
+}
+
+GMLP_TARGET("avx512f,avx2,fma")
+inline void gemv(const std::size_t m,
+                 const std::size_t n,
+                 const float* A,
+                 const std::size_t lda,
+                 const float* x,
+                 float* y)
+{
+    std::size_t i = 0;
+    for (; i + 4 <= m; i += 4)
+    {
+        const float* a0 = A + i * lda;
+        const float* a1 = a0 + lda;
+        const float* a2 = a1 + lda;
+        const float* a3 = a2 + lda;
+        __m512 acc0 = _mm512_setzero_ps();
+        __m512 acc1 = _mm512_setzero_ps();
+        __m512 acc2 = _mm512_setzero_ps();
+        __m512 acc3 = _mm512_setzero_ps();
+        for (std::size_t j = 0; j < n; j += 16)
+        {
+            const __mmask16 mask = n - j >= 16 ? static_cast<__mmask16>(0xffff) : tail_mask(n - j);
+            const __m512 vx = _mm512_maskz_loadu_ps(mask, x + j);
+            acc0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a0 + j), vx, acc0);
+            acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a1 + j), vx, acc1);
+            acc2 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a2 + j), vx, acc2);
+            acc3 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a3 + j), vx, acc3);
+        }
+        y[i] = hsum(acc0);
+        y[i + 1] = hsum(acc1);
+        y[i + 2] = hsum(acc2);
+        y[i + 3] = hsum(acc3);
+    }
+    for (; i < m; ++i)
+    {
+        y[i] = dot(A + i * lda, x, n);
+    }
+}
+
+// 4 x 32 register tile: C[4 x 32] = A[4 x k] * panel[k x 32]. Rows past m
+// repeat the last valid row and are not stored.
+GMLP_TARGET("avx512f,avx2,fma")
+inline void gemm_tile(const std::size_t rows,
+                      const std::size_t cols,
+                      const std::size_t k,
+                      const float* A,
+                      const std::size_t lda,
+                      const float* panel,
+                      const std::size_t width,
+                      float* C,
+                      const std::size_t ldc)
+{
+    const float* a0 = A;
+    const float* a1 = rows > 1 ? a0 + lda : a0;
+    const float* a2 = rows > 2 ? a1 + lda : a1;
+    const float* a3 = rows > 3 ? a2 + lda : a2;
+    __m512 c00 = _mm512_setzero_ps();
+    __m512 c01 = _mm512_setzero_ps();
+    __m512 c10 = _mm512_setzero_ps();
+    __m512 c11 = _mm512_setzero_ps();
+    __m512 c20 = _mm512_setzero_ps();
+    __m512 c21 = _mm512_setzero_ps();
+    __m512 c30 = _mm512_setzero_ps();
+    __m512 c31 = _mm512_setzero_ps();
+    for (std::size_t p = 0; p < k; ++p)
+    {
+        const __m512 b0 = _mm512_loadu_ps(panel + p * width);
+        const __m512 b1 = _mm512_loadu_ps(panel + p * width + 16);
+        __m512 va = _mm512_set1_ps(a0[p]);
+        c00 = _mm512_fmadd_ps(va, b0, c00);
+        c01 = _mm512_fmadd_ps(va, b1, c01);
+        va = _mm512_set1_ps(a1[p]);
+        c10 = _mm512_fmadd_ps(va, b0, c10);
+        c11 = _mm512_fmadd_ps(va, b1, c11);
+        va = _mm512_set1_ps(a2[p]);
+        c20 = _mm512_fmadd_ps(va, b0, c20);
+        c21 = _mm512_fmadd_ps(va, b1, c21);
+        va = _mm512_set1_ps(a3[p]);
+        c30 = _mm512_fmadd_ps(va, b0, c30);
+        c31 = _mm512_fmadd_ps(va, b1, c31);
+    }
+    const __mmask16 mask0 = cols >= 16 ? static_cast<__mmask16>(0xffff) : tail_mask(cols);
+    const __mmask16 mask1 = cols >= 32 ? static_cast<__mmask16>(0xffff) : cols > 16 ? tail_mask(cols - 16) : 0;
+    _mm512_mask_storeu_ps(C, mask0, c00);
+    _mm512_mask_storeu_ps(C + 16, mask1, c01);
+    if (rows > 1)
+    {
+        _mm512_mask_storeu_ps(C + ldc, mask0, c10);
+        _mm512_mask_storeu_ps(C + ldc + 16, mask1, c11);
+    }
+    if (rows > 2)
+    {
+        _mm512_mask_storeu_ps(C + 2 * ldc, mask0, c20);
+        _mm512_mask_storeu_ps(C + 2 * ldc + 16, mask1, c21);
+    }
+    if (rows > 3)
+    {
+        _mm512_mask_storeu_ps(C + 3 * ldc, mask0, c30);
+        _mm512_mask_storeu_ps(C + 3 * ldc + 16, mask1, c31);
+    }
+}
+
+GMLP_TARGET("avx512f,avx2,fma")
+inline void gemm_packed(const std::size_t m,
+                        const std::size_t n,
+                        const std::size_t k,
+                        const float* A,
+                        const std::size_t lda,
+                        const float* packed,
+                        float* C,
+                        const std::size_t ldc)
+{
+    constexpr std::size_t tile = 32;
+    const auto width = packed_width(n);
+    for (std::size_t i = 0; i < m; i += 4)
+    {
+        for (std::size_t j = 0; j < n; j += tile)
+        {
+            gemm_tile(std::min<std::size_t>(4, m - i), std::min(tile, n - j), k,
+                      A + i * lda, lda, packed + j, width, C + i * ldc + j, ldc);
+        }
+    }
+}
+
+GMLP_TARGET("avx512f,avx2,fma")
+inline __m512 exp_approx(__m512 x,
+                         const Precision precision)
+{
+    x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(exp_min)), _mm512_set1_ps(exp_max));
+    const __m512 n = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(log2e)),
+                                          _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(ln2_hi), x);
+    r = _mm512_fnmadd_ps(n, _mm512_set1_ps(ln2_lo), r);
+    const __m512 one = _mm512_set1_ps(1.0f);
+    __m512 p;
+    if (precision == Precision::Low)
+    {
+        p = _mm512_fmadd_ps(_mm512_set1_ps(exp_q0), r, _mm512_set1_ps(exp_q1));
+        p = _mm512_fmadd_ps(p, r, one);
+        p = _mm512_fmadd_ps(p, r, one);
+    }
+    else
+    {
+        p = _mm512_fmadd_ps(_mm512_set1_ps(exp_p0), r, _mm512_set1_ps(exp_p1));
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(exp_p2));
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(exp_p3));
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(exp_p4));
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(exp_p5));
+        p = _mm512_fmadd_ps(p, _mm512_mul_ps(r, r), _mm512_add_ps(r, one));
+    }
+    return _mm512_scalef_ps(p, n);
+}
+
+// Precision::Low replaces the division by the reciprocal estimate
+GMLP_TARGET("avx512f,avx2,fma")
+inline __m512 sigmoid_approx(const __m512 x,
+                             const Precision precision)
+{
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512 denom = _mm512_add_ps(one, exp_approx(_mm512_sub_ps(_mm512_setzero_ps(), x), precision));
+    return precision == Precision::Low ? _mm512_rcp14_ps(denom) : _mm512_div_ps(one, denom);
+}
+
+GMLP_TARGET("avx512f,avx2,fma")
+inline void exp(float* x,
+                const std::size_t n,
+                const Precision precision)
+{
+    for (std::size_t i = 0; i < n; i += 16)
+    {
+        const __mmask16 mask = n - i >= 16 ? static_cast<__mmask16>(0xffff) : tail_mask(n - i);
+        _mm512_mask_storeu_ps(x + i, mask, exp_approx(_mm512_maskz_loadu_ps(mask, x + i), precision));
+    }
+}
+
+GMLP_TARGET("avx512f,avx2,fma")
+inline void sigmoid(float* x,
+                    const std::size_t n,
+                    const Precision precision)
+{
+    for (std::size_t i = 0; i < n; i += 16)
+    {
+        const __mmask16 mask = n - i >= 16 ? static_cast<__mmask16>(0xffff) : tail_mask(n - i);
+        _mm512_mask_storeu_ps(x + i, mask, sigmoid_approx(_mm512_maskz_loadu_ps(mask, x + i), precision));
+    }
+}
+
+GMLP_TARGET("avx512f,avx2,fma")
+inline void tanh(float* x,
+                 const std::size_t n,
+                 const Precision precision)
+{
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512 two = _mm512_set1_ps(2.0f);
+    for (std::size_t i = 0; i < n; i += 16)
+    {
+        const __mmask16 mask = n - i >= 16 ? static_cast<__mmask16>(0xffff) : tail_mask(n - i);
+        const __m512 s = sigmoid_approx(_mm512_mul_ps(two, _mm512_maskz_loadu_ps(mask, x + i)), precision);
+        _mm512_mask_storeu_ps(x + i, mask, _mm512_fmsub_ps(two, s, one));
+    }
+}
+
+GMLP_TARGET("avx512f,avx2,fma")
+inline void momentum(float* w,
+                     float* v,
+                     const float* g,
+                     const std::size_t n,
+                     const StepParams& params)
+{
+    const __m512 lr = _mm512_set1_ps(params.learning_rate);
+    const __m512 scale = _mm512_set1_ps(params.gradient_scale);
+    const __m512 beta1 = _mm512_set1_ps(params.beta1);
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        const __m512 gi = _mm512_mul_ps(_mm512_loadu_ps(g + i), scale);
+        const __m512 vi = _mm512_fmadd_ps(beta1, _mm512_loadu_ps(v + i), gi);
+        const __m512 d = params.nesterov ? _mm512_fmadd_ps(beta1, vi, gi) : vi;
+        _mm512_storeu_ps(v + i, vi);
+        _mm512_storeu_ps(w + i, _mm512_fnmadd_ps(lr, d, _mm512_loadu_ps(w + i)));
+    }
+    scalar::momentum(w + i, v + i, g + i, n - i, params);
+}
+
+GMLP_TARGET("avx512f,avx2,fma")
+inline void rmsprop(float* w,
+                    float* s,
+                    const float* g,
+                    const std::size_t n,
+                    const StepParams& params)
+{
+    const __m512 lr = _mm512_set1_ps(params.learning_rate);
+    const __m512 scale = _mm512_set1_ps(params.gradient_scale);
+    const __m512 beta2 = _mm512_set1_ps(params.beta2);
+    const __m512 one_minus_beta2 = _mm512_set1_ps(1.0f - params.beta2);
+    const __m512 epsilon = _mm512_set1_ps(params.epsilon);
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        const __m512 gi = _mm512_mul_ps(_mm512_loadu_ps(g + i), scale);
+        const __m512 si = _mm512_fmadd_ps(beta2, _mm512_loadu_ps(s + i), _mm512_mul_ps(one_minus_beta2, _mm512_mul_ps(gi, gi)));
+        const __m512 d = _mm512_div_ps(gi, _mm512_add_ps(_mm512_sqrt_ps(si), epsilon));
+        _mm512_storeu_ps(s + i, si);
+        _mm512_storeu_ps(w + i, _mm512_fnmadd_ps(lr, d, _mm512_loadu_ps(w + i)));
+    }
+    scalar::rmsprop(w + i, s + i, g + i, n - i, params);
+}
+
+GMLP_TARGET("avx512f,avx2,fma")
+inline void adam(float* w,
+                 float* m,
+                 float* v,
+                 const float* g,
+                 const std::size_t n,
+                 const StepParams& params)
+{
+    const __m512 lr = _mm512_set1_ps(params.learning_rate);
+    const __m512 scale = _mm512_set1_ps(params.gradient_scale);
+    const __m512 beta1 = _mm512_set1_ps(params.beta1);
+    const __m512 one_minus_beta1 = _mm512_set1_ps(1.0f - params.beta1);
+    const __m512 beta2 = _mm512_set1_ps(params.beta2);
+    const __m512 one_minus_beta2 = _mm512_set1_ps(1.0f - params.beta2);
+    const __m512 epsilon = _mm512_set1_ps(params.epsilon);
+    const __m512 decay = _mm512_set1_ps(params.decay);
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        const __m512 gi = _mm512_mul_ps(_mm512_loadu_ps(g + i), scale);
+        const __m512 mi = _mm512_fmadd_ps(beta1, _mm512_loadu_ps(m + i), _mm512_mul_ps(one_minus_beta1, gi));
+        const __m512 vi = _mm512_fmadd_ps(beta2, _mm512_loadu_ps(v + i), _mm512_mul_ps(one_minus_beta2, _mm512_mul_ps(gi, gi)));
+        const __m512 d = _mm512_div_ps(mi, _mm512_add_ps(_mm512_sqrt_ps(vi), epsilon));
+        const __m512 wi = _mm512_loadu_ps(w + i);
+        _mm512_storeu_ps(m + i, mi);
+        _mm512_storeu_ps(v + i, vi);
+        _mm512_storeu_ps(w + i, _mm512_fnmadd_ps(lr, d, _mm512_fnmadd_ps(decay, wi, wi)));
+    }
+    scalar::adam(w + i, m + i, v + i, g + i, n - i, params);
+}
+
+// loaders widening 16 bfloat16 or half values to float
+struct LoadBF16
+{
+    GMLP_TARGET("avx512f,avx2,fma")
+    static __m512 load(const std::uint16_t* x)
+    {
+        const __m512i bits = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(x)));
+        return _mm512_castsi512_ps(_mm512_slli_epi32(bits, 16));
+    }
+};
+
+struct LoadFP16
+{
+    GMLP_TARGET("avx512f,avx2,fma")
+    static __m512 load(const std::uint16_t* x)
+    {
+        return _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(x)));
+    }
+};
+
+GMLP_TARGET("avx512f,avx2,fma")
+inline void bf16_to_float(const std::uint16_t* x,
+                          float* y,
+                          const std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        _mm512_storeu_ps(y + i, LoadBF16::load(x + i));
+    }
+    scalar::bf16_to_float(x + i, y + i, n - i);
+}
+
+GMLP_TARGET("avx512f,avx2,fma")
+inline void fp16_to_float(const std::uint16_t* x,
+                          float* y,
+                          const std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        _mm512_storeu_ps(y + i, LoadFP16::load(x + i));
+    }
+    scalar::fp16_to_float(x + i, y + i, n - i);
+}
+
+// gemv of 16-bit rows, four rows at a time like gemv. AVX-512F has no masked
+// 16-bit loads so the tail of each row is scalar.
+template<typename Load,
+         float (*widen)(std::uint16_t)>
+GMLP_TARGET("avx512f,avx2,fma")
+void gemv_widen(const std::size_t m,
+                const std::size_t n,
+                const std::uint16_t* A,
+                const std::size_t lda,
+                const float* x,
+                float* y)
+{
+    std::size_t i = 0;
+    for (; i + 4 <= m; i += 4)
+    {
+        const std::uint16_t* a0 = A + i * lda;
+        const std::uint16_t* a1 = a0 + lda;
+        const std::uint16_t* a2 = a1 + lda;
+        const std::uint16_t* a3 = a2 + lda;
+        __m512 acc0 = _mm512_setzero_ps();
+        __m512 acc1 = _mm512_setzero_ps();
+        __m512 acc2 = _mm512_setzero_ps();
+        __m512 acc3 = _mm512_setzero_ps();
+        std::size_t j = 0;
+        for (; j + 16 <= n; j += 16)
+        {
+            const __m512 vx = _mm512_loadu_ps(x + j);
+            acc0 = _mm512_fmadd_ps(Load::load(a0 + j), vx, acc0);
+            acc1 = _mm512_fmadd_ps(Load::load(a1 + j), vx, acc1);
+            acc2 = _mm512_fmadd_ps(Load::load(a2 + j), vx, acc2);
+            acc3 = _mm512_fmadd_ps(Load::load(a3 + j), vx, acc3);
+        }
+        float y0 = hsum(acc0);
+        float y1 = hsum(acc1);
+        float y2 = hsum(acc2);
+        float y3 = hsum(acc3);
+        for (; j < n; ++j)
+        {
+            y0 += widen(a0[j]) * x[j];
+            y1 += widen(a1[j]) * x[j];
+            y2 += widen(a2[j]) * x[j];
+            y3 += widen(a3[j]) * x[j];
+        }
+        y[i] = y0;
+        y[i + 1] = y1;
+        y[i + 2] = y2;
+        y[i + 3] = y3;
+    }
+    scalar::gemv_widen<widen>(m - i, n, A + i * lda, lda, x, y + i);
+}
+
+GMLP_TARGET("avx512f,avx2,fma")
+inline void gemv_bf16(const std::size_t m,
+                      const std::size_t n,
+                      const std::uint16_t* A,
+                      const std::size_t lda,
+                      const float* x,
+                      float* y)
+{
+    gemv_widen<LoadBF16, bf16_bits_to_float>(m, n, A, lda, x, y);
+}
+
+GMLP_TARGET("avx512f,avx2,fma")
+inline void gemv_fp16(const std::size_t m,
+                      const std::size_t n,
+                      const std::uint16_t* A,
+                      const std::size_t lda,
+                      const float* x,
+                      float* y)
+{
+    gemv_widen<LoadFP16, fp16_bits_to_float>(m, n, A, lda, x, y);
+}
+
+}
+
+// AVX-512 VNNI, which multiplies and sums four pairs of unsigned and signed
+// bytes into each 32-bit lane in one instruction. It is an extension of
+// AVX-512 so it is not an Isa of its own, make_table picks it up if present.
+namespace vnni
+{
+
+GMLP_TARGET("avx512f,avx512bw,avx512vnni,avx2,fma")
+inline void gemv_u8s8(const std::size_t m,
+                      const std::size_t n,
+                      const std::int8_t* A,
+                      const std::size_t lda,
+                      const std::uint8_t* x,
+                      std::int32_t* y)
+{
+    std::size_t i = 0;
+    for (; i + 4 <= m; i += 4)
+    {
+        const std::int8_t* a0 = A + i * lda;
+        const std::int8_t* a1 = a0 + lda;
+        const std::int8_t* a2 = a1 + lda;
+        const std::int8_t* a3 = a2 + lda;
+        __m512i acc0 = _mm512_setzero_si512();
+        __m512i acc1 = _mm512_setzero_si512();
+        __m512i acc2 = _mm512_setzero_si512();
+        __m512i acc3 = _mm512_setzero_si512();
+        for (std::size_t j = 0; j < n; j += 64)
+        {
+            const __mmask64 mask = n - j >= 64 ? ~__mmask64{0} : (__mmask64{1} << (n - j)) - 1;
+            const __m512i vx = _mm512_maskz_loadu_epi8(mask, x + j);
+            acc0 = _mm512_dpbusd_epi32(acc0, vx, _mm512_maskz_loadu_epi8(mask, a0 + j));
+            acc1 = _mm512_dpbusd_epi32(acc1, vx, _mm512_maskz_loadu_epi8(mask, a1 + j));
+            acc2 = _mm512_dpbusd_epi32(acc2, vx, _mm512_maskz_loadu_epi8(mask, a2 + j));
+            acc3 = _mm512_dpbusd_epi32(acc3, vx, _mm512_maskz_loadu_epi8(mask, a3 + j));
+        }
+        y[i] = _mm512_reduce_add_epi32(acc0);
+        y[i + 1] = _mm512_reduce_add_epi32(acc1);
+        y[i + 2] = _mm512_reduce_add_epi32(acc2);
+        y[i + 3] = _mm512_reduce_add_epi32(acc3);
+    }
+    scalar::gemv_u8s8(m - i, n, A + i * lda, lda, x, y + i);
+}
+
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+inline bool cpu_supports(const Isa isa)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_cpu_init();
+    switch (isa)
+    {
+        case Isa::SSE2: return __builtin_cpu_supports("sse2");
+        case Isa::AVX2: return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        case Isa::AVX512: return __builtin_cpu_supports("avx512f");
+        default: return isa == Isa::Scalar;
+    }
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    const int max_leaf = info[0];
+    __cpuid(info, 1);
+    const bool sse2 = (info[3] & (1 << 26)) != 0;
+    const bool fma = (info[2] & (1 << 12)) != 0;
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    const bool os_avx = (xcr0 & 0x6) == 0x6;
+    const bool os_avx512 = (xcr0 & 0xe6) == 0xe6;
+    bool avx2 = false;
+    bool avx512f = false;
+    if (max_leaf >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+        avx512f = (info[1] & (1 << 16)) != 0;
+    }
+    switch (isa)
+    {
+        case Isa::SSE2: return sse2;
+        case Isa::AVX2: return avx2 && fma && os_avx;
+        case Isa::AVX512: return avx512f && os_avx512;
+        default: return isa == Isa::Scalar;
+    }
+#else
+    return isa == Isa::Scalar;
+#endif
+}
+
+inline bool cpu_supports_vnni()
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vnni");
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+    {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 30)) != 0 && (info[2] & (1 << 11)) != 0;
+#else
+    return false;
+#endif
+}
+
+#endif // GMLP_X86
+
+#ifdef GMLP_NEON
+
+namespace neon
+{
+
+inline float dot(const float* x,
+                 const float* y,
+                 const std::size_t n)
+{
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(x + i), vld1q_f32(y + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(x + i + 4), vld1q_f32(y + i + 4));
+    }
+    for (; i + 4 <= n; i += 4)
+    {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(x + i), vld1q_f32(y + i));
+    }
+    float result = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < n; ++i)
+    {
+        result += x[i] * y[i];
+    }
+    return result;
+}
+
+inline void axpy(const float a,
+                 const float* x,
+                 float* y,
+                 const std::size_t n)
+{
+    const float32x4_t va = vdupq_n_f32(a);
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        vst1q_f32(y + i, vfmaq_f32(vld1q_f32(y + i), va, vld1q_f32(x + i)));
+    }
+    for (; i < n; ++i)
+    {
+        y[i] += a * x[i];
+    }
+}
+
+inline void gemv(const std::size_t m,
+                 const std::size_t n,
+                 const float* A,
+                 const std::size_t lda,
+                 const float* x,
+                 float* y)
+{
+    for (std::size_t i = 0; i < m; ++i)
+    {
+        y[i] = dot(A + i * lda, x, n);
+    }
+}
+
+inline void gemm_packed(const std::size_t m,
+                        const std::size_t n,
+                        const std::size_t k,
+                        const float* A,
+                        const std::size_t lda,
+                        const float* packed,
+                        float* C,
+                        const std::size_t ldc)
+{
+    gemm_packed_by_rows(axpy, m, n, k, A, lda, packed, C, ldc);
+}
+
+}
+
+#endif // GMLP_NEON
+
+inline bool isa_available(const Isa isa)
+{
+#if defined(GMLP_X86)
+    return isa != Isa::NEON && cpu_supports(isa);
+#elif defined(GMLP_NEON)
+    return isa == Isa::Scalar || isa == Isa::NEON;
+#else
+    return isa == Isa::Scalar;
+#endif
+}
+
+inline Isa detect_isa()
+{
+    Isa limit = Isa::NEON;
+    if (const char* env = std::getenv("GMLP_ISA"))
+    {
+        for (const Isa isa : {Isa::Scalar, Isa::SSE2, Isa::AVX2, Isa::AVX512, Isa::NEON})
+        {
+            if (std::strcmp(env, isa_name(isa)) == 0)
+            {
+                limit = isa;
+            }
+        }
+    }
+    for (const Isa isa : {Isa::NEON, Isa::AVX512, Isa::AVX2, Isa::SSE2})
+    {
+        if (isa <= limit && isa_available(isa))
+        {
+            return isa;
+        }
+    }
+    return Isa::Scalar;
+}
+
+inline KernelTable make_table(const Isa isa)
+{
+    switch (isa)
+    {
+#ifdef GMLP_X86
+        case Isa::SSE2: return {isa, sse2::dot, sse2::axpy, sse2::gemv, sse2::gemm_packed,
+                                scalar::exp, scalar::sigmoid, scalar::tanh,
+                                scalar::momentum, scalar::rmsprop, scalar::adam,
+                                scalar::bf16_to_float, scalar::fp16_to_float,
+                                scalar::gemv_bf16, scalar::gemv_fp16, scalar::gemv_u8s8};
+        case Isa::AVX2: return {isa, avx2::dot, avx2::axpy, avx2::gemv, avx2::gemm_packed,
+                                avx2::exp, avx2::sigmoid, avx2::tanh,
+                                avx2::momentum, avx2::rmsprop, avx2::adam,
+                                avx2::bf16_to_float, avx2::fp16_to_float,
+                                avx2::gemv_bf16, avx2::gemv_fp16, avx2::gemv_u8s8};
+        case Isa::AVX512: return {isa, avx512::dot, avx512::axpy, avx512::gemv, avx512::gemm_packed,
+                                  avx512::exp, avx512::sigmoid, avx512::tanh,
+                                  avx512::momentum, avx512::rmsprop, avx512::adam,
+                                  avx512::bf16_to_float, avx512::fp16_to_float,
+                                  avx512::gemv_bf16, avx512::gemv_fp16,
+                                  cpu_supports_vnni() ? vnni::gemv_u8s8 : avx2::gemv_u8s8};
+#endif
+#ifdef GMLP_NEON
+        case Isa::NEON: return {isa, neon::dot, neon::axpy, neon::gemv, neon::gemm_packed,
+                                scalar::exp, scalar::sigmoid, scalar::tanh,
+                                scalar::momentum, scalar::rmsprop, scalar::adam,
+                                scalar::bf16_to_float, scalar::fp16_to_float,
+                                scalar::gemv_bf16, scalar::gemv_fp16, scalar::gemv_u8s8};
+#endif
+        default: return {Isa::Scalar, scalar::dot, scalar::axpy, scalar::gemv, scalar::gemm_packed,
+                         scalar::exp, scalar::sigmoid, scalar::tanh,
+                         scalar::momentum, scalar::rmsprop, scalar::adam,
+                         scalar::bf16_to_float, scalar::fp16_to_float,
+                         scalar::gemv_bf16, scalar::gemv_fp16, scalar::gemv_u8s8};
+    }
+}
+
+inline const KernelTable& get_table()
+{
+    static const KernelTable table = make_table(detect_isa());
+    return table;
+}
+
+}
+
+inline Isa get_isa()
+{
+    return detail::get_table().isa;
+}
+
+// All matrices are row-major with an explicit leading dimension (the distance
+// between two consecutive rows) so that they can address the weight matrix of
+// a layer which carries an extra bias column.
+
+inline float dot(const float* x,
+                 const float* y,
+                 const std::size_t n)
+{
+    return detail::get_table().dot(x, y, n);
+}
+
+// y += a * x
+inline void axpy(const float a,
+                 const float* x,
+                 float* y,
+                 const std::size_t n)
+{
+    detail::get_table().axpy(a, x, y, n);
+}
+
+// y[m] = A[m x n] * x
+inline void gemv(const std::size_t m,
+                 const std::size_t n,
+                 const float* A,
+                 const std::size_t lda,
+                 const float* x,
+                 float* y)
+{
+    detail::get_table().gemv(m, n, A, lda, x, y);
+}
+
+// x = exp(x)
+inline void exp(float* x,
+                const std::size_t n,
+                const Precision precision)
+{
+    if (precision == Precision::Exact)
+    {
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            x[i] = std::exp(x[i]);
+        }
+        return;
+    }
+    detail::get_table().exp(x, n, precision);
+}
+
+// x = 1 / (1 + exp(-x))
+inline void sigmoid(float* x,
+                    const std::size_t n,
+                    const Precision precision)
+{
+    if (precision == Precision::Exact)
+    {
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            x[i] = 1.0f / (1.0f + std::exp(-x[i]));
+        }
+        return;
+    }
+    detail::get_table().sigmoid(x, n, precision);
+}
+
+// x = tanh(x)
+inline void tanh(float* x,
+                 const std::size_t n,
+                 const Precision precision)
+{
+    if (precision == Precision::Exact)
+    {
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            x[i] = std::tanh(x[i]);
+        }
+        return;
+    }
+    detail::get_table().tanh(x, n, precision);
+}
+
+// v = beta1 * v + g
+// w -= learning_rate * (nesterov ? g + beta1 * v : v)
+inline void momentum_step(float* w,
+                          float* v,
+                          const float* g,
+                          const std::size_t n,
+                          const StepParams& params)
+{
+    detail::get_table().momentum(w, v, g, n, params);
+}
+
+// s = beta2 * s + (1 - beta2) * g^2
+// w -= learning_rate * g / (sqrt(s) + epsilon)
+inline void rmsprop_step(float* w,
+                         float* s,
+                         const float* g,
+                         const std::size_t n,
+                         const StepParams& params)
+{
+    detail::get_table().rmsprop(w, s, g, n, params);
+}
+
+// m = beta1 * m + (1 - beta1) * g
+// v = beta2 * v + (1 - beta2) * g^2
+// w -= decay * w + learning_rate * m / (sqrt(v) + epsilon)
+inline void adam_step(float* w,
+                      float* m,
+                      float* v,
+                      const float* g,
+                      const std::size_t n,
+                      const StepParams& params)
+{
+    detail::get_table().adam(w, m, v, g, n, params);
+}
+
+// y = x for n bfloat16 values x, see detail::float_to_bf16_bits
+inline void bf16_to_float(const std::uint16_t* x,
+                          float* y,
+                          const std::size_t n)
+{
+    detail::get_table().bf16_to_float(x, y, n);
+}
+
+// y = x for n IEEE half precision values x
+inline void fp16_to_float(const std::uint16_t* x,
+                          float* y,
+                          const std::size_t n)
+{
+    detail::get_table().fp16_to_float(x, y, n);
+}
+
+// y[m] = A[m x n] * x[n] with A stored as bfloat16 or half
+inline void gemv_bf16(const std::size_t m,
+                      const std::size_t n,
+                      const std::uint16_t* A,
+                      const std::size_t lda,
+                      const float* x,
+                      float* y)
+{
+    detail::get_table().gemv_bf16(m, n, A, lda, x, y);
+}
+
+inline void gemv_fp16(const std::size_t m,
+                      const std::size_t n,
+                      const std::uint16_t* A,
+                      const std::size_t lda,
+                      const float* x,
+                      float* y)
+{
+    detail::get_table().gemv_fp16(m, n, A, lda, x, y);
+}
+
+// y[m] = A[m x n] * x[n] for signed bytes A and unsigned bytes x, using
+// AVX-512 VNNI if available
+inline void gemv_u8s8(const std::size_t m,
+                      const std::size_t n,
+                      const std::int8_t* A,
+                      const std::size_t lda,
+                      const std::uint8_t* x,
+                      std::int32_t* y)
+{
+    detail::get_table().gemv_u8s8(m, n, A, lda, x, y);
+}
+
+// number of floats needed by pack_nt for an n x k matrix B
+inline std::size_t packed_size(const std::size_t n,
+                               const std::size_t k)
+{
+    return detail::packed_width(n) * k;
+}
+
+// packs B[n x k] into the layout expected by gemm_packed, widening the
+// values to float if B is stored in a narrower type
+template<typename T>
+void pack_nt(const T* B,
+             const std::size_t ldb,
+             const std::size_t n,
+             const std::size_t k,
+             float* packed)
+{
+    detail::pack_nt(B, ldb, n, k, packed);
+}
+
+// C[m x n] = A[m x k] * B[n x k]^T with B packed by pack_nt. Packing B once
+// pays off when it is multiplied with many rows of A: the kernels then
+// work on register tiles of 4 rows of A by 16 (AVX2) or 32 (AVX-512)
+// columns of B^T and never need a horizontal sum.
+inline void gemm_packed(const std::size_t m,
+                        const std::size_t n,
+                        const std::size_t k,
+                        const float* A,
+                        const std::size_t lda,
+                        const float* packed,
+                        float* C,
+                        const std::size_t ldc)
+{
+    detail::get_table().gemm_packed(m, n, k, A, lda, packed, C, ldc);
+}
+
+// C[m x n] = A[m x k] * B[n x k]^T
+// Few rows are computed as one gemv per row, more rows pack B into a buffer
+// of the calling thread first.
+inline void gemm_nt(const std::size_t m,
+                    const std::size_t n,
+                    const std::size_t k,
+                    const float* A,
+                    const std::size_t lda,
+                    const float* B,
+                    const std::size_t ldb,
+                    float* C,
+                    const std::size_t ldc)
+{
+    const auto& table = detail::get_table();
+    if (m < 16)
+    {
+        for (std::size_t i = 0; i < m; ++i)
+        {
+            table.gemv(n, k, B, ldb, A + i * lda, C + i * ldc);
+        }
+        return;
+    }
+    thread_local std::vector<float> packed;
+    packed.resize(std::max(packed.size(), packed_size(n, k)));
+    detail::pack_nt(B, ldb, n, k, packed.data());
+    table.gemm_packed(m, n, k, A, lda, packed.data(), C, ldc);
+}
+
+// C[m x n] = A[m x k] * B[k x n]
+// Like gemm_nt few rows are computed as axpy's of the rows of B, more rows
+// copy B into the packed layout and use the register tiles of gemm_packed.
+inline void gemm_nn(const std::size_t m,
+                    const std::size_t n,
+                    const std::size_t k,
+                    const float* A,
+                    const std::size_t lda,
+                    const float* B,
+                    const std::size_t ldb,
+                    float* C,
+                    const std::size_t ldc)
+{
+    const auto& table = detail::get_table();
+    if (m < 16)
+    {
+        for (std::size_t i = 0; i < m; ++i)
+        {
+            std::fill(C + i * ldc, C + i * ldc + n, 0.0f);
+            for (std::size_t p = 0; p < k; ++p)
+            {
+                table.axpy(A[i * lda + p], B + p * ldb, C + i * ldc, n);
+            }
+        }
+        return;
+    }
+    thread_local std::vector<float> packed;
+    packed.resize(std::max(packed.size(), packed_size(n, k)));
+    detail::pack_nn(B, ldb, n, k, packed.data());
+    table.gemm_packed(m, n, k, A, lda, packed.data(), C, ldc);
+}
+
+// C[m x n] = A[k x m]^T * B[k x n]
+// The same as gemm_nn with A transposed into a buffer of the calling thread.
+inline void gemm_tn(const std::size_t m,
+                    const std::size_t n,
+                    const std::size_t k,
+                    const float* A,
+                    const std::size_t lda,
+                    const float* B,
+                    const std::size_t ldb,
+                    float* C,
+                    const std::size_t ldc)
+{
+    const auto& table = detail::get_table();
+    if (m < 16)
+    {
+        for (std::size_t i = 0; i < m; ++i)
+        {
+            std::fill(C + i * ldc, C + i * ldc + n, 0.0f);
+        }
+        for (std::size_t p = 0; p < k; ++p)
+        {
+            for (std::size_t i = 0; i < m; ++i)
+            {
+                table.axpy(A[p * lda + i], B + p * ldb, C + i * ldc, n);
+            }
+        }
+        return;
+    }
+    thread_local std::vector<float> transposed;
+    transposed.resize(std::max(transposed.size(), m * k));
+    for (std::size_t p = 0; p < k; ++p)
+    {
+        for (std::size_t i = 0; i < m; ++i)
+        {
+            transposed[i * k + p] = A[p * lda + i];
+        }
+    }
+    gemm_nn(m, n, k, transposed.data(), k, B, ldb, C, ldc);
+}
+
+}
+
+}
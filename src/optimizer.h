@@ -0,0 +1,489 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "kernels.h"
+
+namespace gmlp
+{
+
+namespace optimizer
+{
+
+// Updates the weights from their gradients. Optimizers with state keep it
+// in flat arrays parallel to the weights, so every step is a single fused
+// pass over all parameters.
+class Optimizer
+{
+public:
+    virtual ~Optimizer() = default;
+    // The gradients are multiplied by gradient_scale before they are used,
+    // e.g. 1 / batch_size for gradients summed over a batch.
+    virtual void step(float* weights,
+                      const float* gradients,
+                      std::size_t n,
+                      float learning_rate,
+                      float gradient_scale) = 0;
+    // forgets the state, e.g. before training on different data
+    virtual void reset() = 0;
+    virtual std::unique_ptr<Optimizer> clone() const = 0;
+};
+
+class SGD : public Optimizer
+{
+public:
+    void step(float* weights,
+              const float* gradients,
+              const std::size_t n,
+              const float learning_rate,
+              const float gradient_scale) override
+    {
+        kernels::axpy(-learning_rate * gradient_scale, gradients, weights, n);
+    }
+
+    void reset() override
+    {
+        // nothing to do
+    }
+
+    std::unique_ptr<Optimizer> clone() const override
+    {
+        return std::make_unique<SGD>(*this);
+    }
+};
+
+// SGD with (heavy ball) momentum or with Nesterov momentum, which applies
+// the gradient as if the velocity had already been added.
+class Momentum : public Optimizer
+{
+public:
+    explicit Momentum(const float momentum = 0.9f,
+                      const bool nesterov = false)
+        : momentum_{momentum}, nesterov_{nesterov}
+    {
+        assert(momentum_ >= 0 && momentum_ < 1);
+    }
+
+    void step(float* weights,
+              const float* gradients,
+              const std::size_t n,
+              const float learning_rate,
+              const float gradient_scale) override
+    {
+        velocity_.resize(n);
+        kernels::StepParams params;
+        params.learning_rate = learning_rate;
+        params.gradient_scale = gradient_scale;
+        params.beta1 = momentum_;
+        params.nesterov = nesterov_;
+        kernels::momentum_step(weights, velocity_.data(), gradients, n, params);
+    }
+
+    void reset() override
+    {
+        velocity_.clear();
+    }
+
+    std::unique_ptr<Optimizer> clone() const override
+    {
+        return std::make_unique<Momentum>(*this);
+    }
+
+private:
+    float momentum_;
+    bool nesterov_;
+    std::vector<float> velocity_;
+};
+
+class Nesterov : public Momentum
+{
+public:
+    explicit Nesterov(const float momentum = 0.9f)
+        : Momentum{momentum, true}
+    {}
+
+    std::unique_ptr<Optimizer> clone() const override
+    {
+        return std::make_unique<Nesterov>(*this);
+    }
+};
+
+// Scales the step of each weight by a running average of its squared
+// gradients.
+class RMSProp : public Optimizer
+{
+public:
+    explicit RMSProp(const float rho = 0.9f,
+                     const float epsilon = 1e-8f)
+        : rho_{rho}, epsilon_{epsilon}
+    {
+        assert(rho_ >= 0 && rho_ < 1);
+    }
+
+    void step(float* weights,
+              const float* gradients,
+              const std::size_t n,
+              const float learning_rate,
+              const float gradient_scale) override
+    {
+        square_average_.resize(n);
+        kernels::StepParams params;
+        params.learning_rate = learning_rate;
+        params.gradient_scale = gradient_scale;
+        params.beta2 = rho_;
+        params.epsilon = epsilon_;
+        kernels::rmsprop_step(weights, square_average_.data(), gradients, n, params);
+    }
+
+    void reset() override
+    {
+        square_average_.clear();
+    }
+
+    std::unique_ptr<Optimizer> clone() const override
+    {
+        return std::make_unique<RMSProp>(*this);
+    }
+
+private:
+    float rho_;
+    float epsilon_;
+    std::vector<float> square_average_;
+};
+
+// Adam, with weight decay decoupled from the gradients as in AdamW if
+// weight_decay is not zero.
+class Adam : public Optimizer
+{
+public:
+    explicit Adam(const float beta1 = 0.9f,
+                  const float beta2 = 0.999f,
+                  const float epsilon = 1e-8f,
+                  const float weight_decay = 0)
+        : beta1_{beta1}, beta2_{beta2}, epsilon_{epsilon}, weight_decay_{weight_decay}
+    {
+        assert(beta1_ >= 0 && beta1_ < 1);
+        assert(beta2_ >= 0 && beta2_ < 1);
+    }
+
+    void step(float* weights,
+              const float* gradients,
+              const std::size_t n,
+              const float learning_rate,
+              const float gradient_scale) override
+    {
+        first_moment_.resize(n);
+        second_moment_.resize(n);
+        ++t_;
+        // the bias correction of both moments is folded into the step size
+        // and epsilon so the kernel does not need to know t
+        const auto correction1 = 1 - std::pow(static_cast<double>(beta1_), static_cast<double>(t_));
+        const auto correction2 = std::sqrt(1 - std::pow(static_cast<double>(beta2_), static_cast<double>(t_)));
+        kernels::StepParams params;
+        params.learning_rate = static_cast<float>(learning_rate * correction2 / correction1);
+        params.gradient_scale = gradient_scale;
+        params.beta1 = beta1_;
+        params.beta2 = beta2_;
+        params.epsilon = static_cast<float>(epsilon_ * correction2);
+        params.decay = learning_rate * weight_decay_;
+        kernels::adam_step(weights, first_moment_.data(), second_moment_.data(), gradients, n, params);
+    }
+
+    void reset() override
+    {
+        first_moment_.clear();
+        second_moment_.clear();
+        t_ = 0;
+    }
+
+    std::unique_ptr<Optimizer> clone() const override
+    {
+        return std::make_unique<Adam>(*this);
+    }
+
+private:
+    float beta1_;
+    float beta2_;
+    float epsilon_;
+    float weight_decay_;
+    std::vector<float> first_moment_;
+    std::vector<float> second_moment_;
+    std::size_t t_ = 0;
+};
+
+class AdamW : public Adam
+{
+public:
+    explicit AdamW(const float weight_decay = 0.01f,
+                   const float beta1 = 0.9f,
+                   const float beta2 = 0.999f,
+                   const float epsilon = 1e-8f)
+        : Adam{beta1, beta2, epsilon, weight_decay}
+    {}
+
+    std::unique_ptr<Optimizer> clone() const override
+    {
+        return std::make_unique<AdamW>(*this);
+    }
+};
+
+struct LBFGSOptions
+{
+    std::size_t max_iterations = 100;
+    // number of the most recent steps approximating the inverse Hessian
+    std::size_t history = 10;
+    // stops once the gradient norm falls below tolerance * max(1, |x|)
+    float tolerance = 1e-5f;
+    // halvings of the step before the line search gives up
+    std::size_t max_line_search = 30;
+};
+
+// Minimizes f with limited-memory BFGS and a backtracking line search, where
+// evaluate(x, gradient) returns f(x) and writes the gradient of f at x. Meant
+// for full-batch training of small problems, where it typically converges in
+// tens of iterations. Updates x in place and returns f(x).
+template<typename F>
+float lbfgs(std::vector<float>& x,
+            F&& evaluate,
+            const LBFGSOptions& options = {})
+{
+    assert(options.history > 0);
+    const auto n = x.size();
+    std::vector<float> gradient(n);
+    std::vector<float> direction(n);
+    std::vector<float> x_next(n);
+    std::vector<float> gradient_next(n);
+    // ring buffers of the steps s, the gradient changes y and 1 / (s . y)
+    std::vector<std::vector<float>> s(options.history, std::vector<float>(n));
+    std::vector<std::vector<float>> y(options.history, std::vector<float>(n));
+    std::vector<float> rho(options.history);
+    std::vector<float> alpha(options.history);
+    std::size_t n_pairs = 0;
+    std::size_t newest = 0;
+
+    auto f = evaluate(x.data(), gradient.data());
+    for (std::size_t iteration = 0; iteration < options.max_iterations; ++iteration)
+    {
+        const auto gradient_norm = std::sqrt(kernels::dot(gradient.data(), gradient.data(), n));
+        if (gradient_norm <= options.tolerance * std::max(1.0f, std::sqrt(kernels::dot(x.data(), x.data(), n))))
+        {
+            break;
+        }
+
+        // two-loop recursion, direction = -H * gradient
+        direction = gradient;
+        for (std::size_t k = 0; k < n_pairs; ++k)
+        {
+            const auto i = (newest + options.history - k) % options.history;
+            alpha[i] = rho[i] * kernels::dot(s[i].data(), direction.data(), n);
+            kernels::axpy(-alpha[i], y[i].data(), direction.data(), n);
+        }
+        const auto gamma = n_pairs > 0 ? 1.0f / (rho[newest] * kernels::dot(y[newest].data(), y[newest].data(), n))
+                                       : 1.0f / gradient_norm;
+        for (auto& value : direction)
+        {
+            value *= -gamma;
+        }
+        for (std::size_t k = n_pairs; k--;)
+        {
+            const auto i = (newest + options.history - k) % options.history;
+            const auto beta = rho[i] * kernels::dot(y[i].data(), direction.data(), n);
+            kernels::axpy(-alpha[i] - beta, s[i].data(), direction.data(), n);
+        }
+        auto slope = kernels::dot(gradient.data(), direction.data(), n);
+        if (!(slope < 0))
+        {
+            // not a descent direction, start over with steepest descent
+            n_pairs = 0;
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                direction[i] = -gradient[i] / gradient_norm;
+            }
+            slope = -gradient_norm;
+        }
+
+        // backtracking until the Armijo condition holds
+        float step = 1;
+        float f_next = f;
+        bool found = false;
+        for (std::size_t k = 0; k < options.max_line_search && !found; ++k, step *= 0.5f)
+        {
+            x_next = x;
+            kernels::axpy(step, direction.data(), x_next.data(), n);
+            f_next = evaluate(x_next.data(), gradient_next.data());
+            found = f_next <= f + 1e-4f * step * slope;
+        }
+        if (!found)
+        {
+            break;
+        }
+
+        const auto next = n_pairs > 0 ? (newest + 1) % options.history : newest;
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            s[next][i] = x_next[i] - x[i];
+            y[next][i] = gradient_next[i] - gradient[i];
+        }
+        const auto sy = kernels::dot(s[next].data(), y[next].data(), n);
+        if (sy > 1e-10f)
+        {
+            // only steps of positive curvature keep H positive definite
+            rho[next] = 1.0f / sy;
+            newest = next;
+            n_pairs = std::min(n_pairs + 1, options.history);
+        }
+        x.swap(x_next);
+        gradient.swap(gradient_next);
+        f = f_next;
+    }
+    return f;
+}
+
+struct LevenbergMarquardtOptions
+{
+    std::size_t max_iterations = 100;
+    // initial damping, relative to the mean diagonal entry of J^T * J
+    float damping = 1e-3f;
+    // gives up once the damping exceeds this
+    float max_damping = 1e10f;
+    // stops once an iteration decreases the cost by less than this fraction
+    float tolerance = 1e-6f;
+};
+
+namespace detail
+{
+
+// Solves (A + damping * mean(diag(A)) * I) * x = b for a symmetric positive
+// semidefinite n x n matrix A by a Cholesky decomposition in double
+// precision. Returns false if the damped matrix is not positive definite.
+// Damping by diag(A) itself would allow huge steps of the weights of
+// saturated neurons, whose diagonal entries are almost zero.
+inline bool solve_damped(const std::vector<float>& A,
+                         const std::vector<float>& b,
+                         const float damping,
+                         std::vector<float>& x)
+{
+    const auto n = b.size();
+    double scale = 0;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        scale += A[i * n + i];
+    }
+    scale = std::max(scale / static_cast<double>(n), 1e-12);
+    std::vector<double> L(n * n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        for (std::size_t j = 0; j <= i; ++j)
+        {
+            double sum = A[i * n + j];
+            if (i == j)
+            {
+                sum += damping * scale;
+            }
+            for (std::size_t k = 0; k < j; ++k)
+            {
+                sum -= L[i * n + k] * L[j * n + k];
+            }
+            if (i == j)
+            {
+                if (!(sum > 0))
+                {
+                    return false;
+                }
+                L[i * n + i] = std::sqrt(sum);
+            }
+            else
+            {
+                L[i * n + j] = sum / L[j * n + j];
+            }
+        }
+    }
+    std::vector<double> z(n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        double sum = b[i];
+        for (std::size_t k = 0; k < i; ++k)
+        {
+            sum -= L[i * n + k] * z[k];
+        }
+        z[i] = sum / L[i * n + i];
+    }
+    x.resize(n);
+    for (std::size_t i = n; i--;)
+    {
+        double sum = z[i];
+        for (std::size_t k = i + 1; k < n; ++k)
+        {
+            sum -= L[k * n + i] * z[k];
+        }
+        z[i] = sum / L[i * n + i];
+        x[i] = static_cast<float>(z[i]);
+    }
+    return true;
+}
+
+}
+
+// Minimizes the cost 0.5 * |r(x)|^2 of a residual vector r with the
+// Levenberg-Marquardt method. evaluate(x, A, b) returns the cost at x and
+// writes the Gauss-Newton normal equations A = J^T * J (row-major n x n)
+// and b = J^T * r of the Jacobian J of r, cost(x) returns the cost only.
+// The memory and time per iteration grow with the square and cube of the
+// number of parameters. Updates x in place and returns the cost at x.
+template<typename F,
+         typename C>
+float levenberg_marquardt(std::vector<float>& x,
+                          F&& evaluate,
+                          C&& cost,
+                          const LevenbergMarquardtOptions& options = {})
+{
+    const auto n = x.size();
+    std::vector<float> A(n * n);
+    std::vector<float> b(n);
+    std::vector<float> delta(n);
+    std::vector<float> x_next(n);
+    auto damping = options.damping;
+    auto f = evaluate(x.data(), A.data(), b.data());
+    for (std::size_t iteration = 0; iteration < options.max_iterations; ++iteration)
+    {
+        // raise the damping, i.e. move towards gradient descent, until a
+        // step decreases the cost
+        float f_next = f;
+        while (damping <= options.max_damping)
+        {
+            if (detail::solve_damped(A, b, damping, delta))
+            {
+                x_next = x;
+                kernels::axpy(-1.0f, delta.data(), x_next.data(), n);
+                f_next = cost(x_next.data());
+                if (f_next < f)
+                {
+                    break;
+                }
+            }
+            damping *= 10;
+        }
+        if (damping > options.max_damping)
+        {
+            break;
+        }
+        damping = std::max(damping * 0.1f, 1e-12f);
+        x.swap(x_next);
+        const auto decrease = f - f_next;
+        f = evaluate(x.data(), A.data(), b.data());
+        if (decrease <= options.tolerance * f_next)
+        {
+            break;
+        }
+    }
+    return f;
+}
+
+}
+
+}
@@ -1,11 +1,626 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
 #include <fstream>
+#include <iterator>
+#include <memory>
+#include <random>
 #include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
+#include "BatchPipeline.h"
+#include "csv.h"
+#include "Dataset.h"
+#include "genetic.h"
+#include "init.h"
 #include "Network.h"
+#include "Population.h"
+#include "QuantizedNetwork.h"
+#include "ThreadPool.h"
 #include "utils.h"
 
+// checks the sigmoid and tanh approximations of every available instruction
+// set against the exact functions
+bool check_transfer_precision()
+{
+    using gmlp::kernels::Isa;
+    using gmlp::kernels::Precision;
+    std::vector<float> x;
+    for (int i = -20000; i <= 20000; ++i)
+    {
+        x.push_back(static_cast<float>(i) * 1e-3f);
+    }
+    x.push_back(-100.0f);
+    x.push_back(100.0f);
+    bool success = true;
+    for (const auto isa : {Isa::Scalar, Isa::SSE2, Isa::AVX2, Isa::AVX512, Isa::NEON})
+    {
+        if (!gmlp::kernels::detail::isa_available(isa))
+        {
+            continue;
+        }
+        const auto kernels = gmlp::kernels::detail::make_table(isa);
+        for (const auto& bound : {std::make_pair(Precision::High, 1e-6), std::make_pair(Precision::Low, 1e-3)})
+        {
+            auto sigmoid = x;
+            kernels.sigmoid(sigmoid.data(), sigmoid.size(), bound.first);
+            auto tanh = x;
+            kernels.tanh(tanh.data(), tanh.size(), bound.first);
+            double sigmoid_error = 0;
+            double tanh_error = 0;
+            for (std::size_t i = 0; i < x.size(); ++i)
+            {
+                const double value = x[i];
+                sigmoid_error = std::max(sigmoid_error, std::abs(sigmoid[i] - 1.0 / (1.0 + std::exp(-value))));
+                tanh_error = std::max(tanh_error, std::abs(tanh[i] - std::tanh(value)));
+            }
+            std::cout << gmlp::kernels::isa_name(isa) << " precision=" << static_cast<int>(bound.first)
+                      << " sigmoid_error=" << sigmoid_error << " tanh_error=" << tanh_error << std::endl;
+            if (sigmoid_error > bound.second || tanh_error > bound.second)
+            {
+                std::cout << "error exceeds " << bound.second << std::endl;
+                success = false;
+            }
+        }
+    }
+    return success;
+}
+
+// checks that an exception thrown inside a parallel loop reaches the caller
+// after every thread finished and leaves the pool usable
+bool check_thread_pool_exceptions()
+{
+    gmlp::ThreadPool pool{4};
+    for (const std::size_t throwing : {std::size_t{0}, std::size_t{37}})
+    {
+        bool caught = false;
+        try
+        {
+            pool.parallel_for(1000, [throwing](const std::size_t i, std::size_t)
+            {
+                if (i == throwing)
+                {
+                    throw std::runtime_error{"index " + std::to_string(i)};
+                }
+            });
+        }
+        catch (const std::runtime_error&)
+        {
+            caught = true;
+        }
+        std::atomic<std::size_t> count{0};
+        pool.parallel_for(1000, [&count](std::size_t, std::size_t)
+        {
+            ++count;
+        });
+        if (!caught || count != 1000)
+        {
+            std::cout << "thread pool exception from index " << throwing << " not handled" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// a dataset of n_rows random rows of the given sizes
+std::pair<gmlp::Matrix, gmlp::Matrix> make_random_data(const std::size_t n_rows,
+                                                       const std::size_t x_cols,
+                                                       const std::size_t y_cols,
+                                                       const unsigned seed)
+{
+    std::mt19937 random_engine{seed};
+    std::uniform_real_distribution<float> uniform;
+    gmlp::Matrix X{n_rows, x_cols};
+    gmlp::Matrix y{n_rows, y_cols};
+    for (std::size_t i = 0; i < n_rows; ++i)
+    {
+        for (std::size_t j = 0; j < x_cols; ++j)
+        {
+            X(i, j) = uniform(random_engine);
+        }
+        for (std::size_t j = 0; j < y_cols; ++j)
+        {
+            y(i, j) = uniform(random_engine);
+        }
+    }
+    return {std::move(X), std::move(y)};
+}
+
+// checks that deterministic data-parallel training gives the same weights
+// for any number of threads
+bool check_deterministic_training()
+{
+    const auto data = make_random_data(1500, 6, 2, 1);
+    // the larger batch needs several waves of gradient buffers
+    for (const std::size_t batch_size : {64, 1200})
+    {
+        std::vector<float> reference;
+        for (const std::size_t n_threads : {1, 3, 4})
+        {
+            gmlp::init::DefaultRandomEngine engine{7};
+            gmlp::Network net{gmlp::Regression, {6, 16, 2}, engine};
+            gmlp::ThreadPool pool{n_threads};
+            for (std::size_t epoch = 0; epoch < 3; ++epoch)
+            {
+                net.train(data.first, data.second, 0.1f, batch_size, pool, true);
+            }
+            const std::vector<float> weights(net.get_weights().begin(), net.get_weights().end());
+            if (reference.empty())
+            {
+                reference = weights;
+            }
+            else if (weights != reference)
+            {
+                std::cout << "deterministic training with batch " << batch_size << " differs with "
+                          << n_threads << " threads" << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// whether function throws a std::runtime_error
+template<typename Function>
+bool throws_runtime_error(Function function)
+{
+    try
+    {
+        function();
+    }
+    catch (const std::runtime_error&)
+    {
+        return true;
+    }
+    return false;
+}
+
+std::string read_file(const std::string& path)
+{
+    std::ifstream is{path, std::ios::binary};
+    return {std::istreambuf_iterator<char>{is}, std::istreambuf_iterator<char>{}};
+}
+
+void write_file(const std::string& path,
+                const std::string& contents)
+{
+    std::ofstream os{path, std::ios::binary};
+    os << contents;
+}
+
+// checks that a saved dataset maps back unchanged and that malformed files
+// are rejected
+bool check_dataset_files()
+{
+    const std::string path = "gmlp_test_dataset.bin";
+    auto data = make_random_data(37, 5, 2, 2);
+    gmlp::Matrix values{37, 7};
+    for (std::size_t i = 0; i < values.get_rows(); ++i)
+    {
+        std::copy(data.first.get_row(i), data.first.get_row(i) + 5, values.get_row(i));
+        std::copy(data.second.get_row(i), data.second.get_row(i) + 2, values.get_row(i) + 5);
+    }
+    gmlp::Dataset{std::move(values), 5}.save(path);
+    bool success = true;
+    {
+        const auto dataset = gmlp::Dataset::map(path);
+        success = dataset.get_rows() == 37 && gmlp::mae(dataset.get_X(), data.first) == 0.0f
+                  && gmlp::mae(dataset.get_y(), data.second) == 0.0f;
+    }
+    const auto contents = read_file(path);
+    write_file(path, contents.substr(0, contents.size() - 4));
+    success = success && throws_runtime_error([&] { gmlp::Dataset::map(path); });
+    write_file(path, "GMLPDATA");
+    success = success && throws_runtime_error([&] { gmlp::Dataset::map(path); });
+    auto wrong_version = contents;
+    wrong_version[8] = 2;
+    write_file(path, wrong_version);
+    success = success && throws_runtime_error([&] { gmlp::Dataset::map(path); });
+    std::remove(path.c_str());
+    if (!success)
+    {
+        std::cout << "dataset round trip or validation failed" << std::endl;
+    }
+    return success;
+}
+
+// whether reading the csv file with the contents throws an error which
+// contains message
+bool csv_fails_with(const std::string& contents,
+                    const gmlp::csv::Options& options,
+                    const std::string& message)
+{
+    const std::string path = "gmlp_test.csv";
+    write_file(path, contents);
+    gmlp::ThreadPool pool{2};
+    std::string error;
+    try
+    {
+        gmlp::csv::read(path, options, pool);
+    }
+    catch (const std::runtime_error& e)
+    {
+        error = e.what();
+    }
+    std::remove(path.c_str());
+    return error.find(message) != std::string::npos;
+}
+
+// checks the csv parser on valid and malformed files
+bool check_csv()
+{
+    gmlp::csv::Options options;
+    options.skip_lines = 1;
+    bool success = true;
+    {
+        const std::string path = "gmlp_test.csv";
+        write_file(path, "a,b,c\n1,2,3\n\n 4 , +5,6e1\n");
+        gmlp::ThreadPool pool{2};
+        const auto dataset = gmlp::csv::read(path, options, pool);
+        std::remove(path.c_str());
+        const auto X = dataset.get_X();
+        const auto y = dataset.get_y();
+        success = X.get_rows() == 2 && X.get_cols() == 2 && y.get_cols() == 1
+                  && X(0, 0) == 1.0f && X(0, 1) == 2.0f && y(0, 0) == 3.0f
+                  && X(1, 0) == 4.0f && X(1, 1) == 5.0f && y(1, 0) == 60.0f;
+    }
+    success = success && csv_fails_with("a,b,c\n1,2,3\n\n4,5\n", options, "malformed line 4");
+    success = success && csv_fails_with("a,b,c\n1,2,3\n4,x,6\n", options, "malformed line 3");
+    success = success && csv_fails_with("a,b,c\n1,2,3\n4,5,6,\n", options, "malformed line 3");
+    success = success && csv_fails_with("a,b,c\n", {}, "malformed value");
+    options.x_cols = {0, 2};
+    options.y_cols = {2};
+    success = success && csv_fails_with("a,b,c\n1,2,3\n", options, "column 2 is used twice");
+    options.x_cols = {0, 0};
+    options.y_cols = {1};
+    success = success && csv_fails_with("a,b,c\n1,2,3\n", options, "column 0 is used twice");
+    if (!success)
+    {
+        std::cout << "csv parsing failed" << std::endl;
+    }
+    return success;
+}
+
+// checks that every epoch of the batch pipeline yields each row once
+bool check_batch_pipeline()
+{
+    const std::size_t n_rows = 103;
+    gmlp::Matrix X{n_rows, 2};
+    gmlp::Matrix y{n_rows, 1};
+    for (std::size_t i = 0; i < n_rows; ++i)
+    {
+        X(i, 0) = static_cast<float>(i);
+        X(i, 1) = static_cast<float>(2 * i);
+        y(i, 0) = static_cast<float>(3 * i);
+    }
+    for (const std::size_t shuffle_window : {0, 16})
+    {
+        gmlp::BatchPipeline pipeline{X, y, 10, 5, shuffle_window};
+        for (std::size_t epoch = 0; epoch < 3; ++epoch)
+        {
+            pipeline.rewind();
+            std::vector<std::size_t> counts(n_rows);
+            gmlp::ConstMatrixView batch_X;
+            gmlp::ConstMatrixView batch_y;
+            while (pipeline.next(batch_X, batch_y))
+            {
+                for (std::size_t r = 0; r < batch_X.get_rows(); ++r)
+                {
+                    const auto row = static_cast<std::size_t>(batch_X(r, 0));
+                    if (row >= n_rows || batch_X(r, 1) != X(row, 1) || batch_y(r, 0) != y(row, 0))
+                    {
+                        std::cout << "batch pipeline returned a wrong row" << std::endl;
+                        return false;
+                    }
+                    ++counts[row];
+                }
+            }
+            if (std::count(counts.begin(), counts.end(), std::size_t{1}) != static_cast<std::ptrdiff_t>(n_rows))
+            {
+                std::cout << "batch pipeline epoch with shuffle window " << shuffle_window
+                          << " does not yield every row once" << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// checks that a consumer slower than the producer never waits for a batch
+// after the first epoch, also not for the first batch after a rewind
+bool check_batch_pipeline_prefetch()
+{
+    const auto data = make_random_data(103, 2, 1, 4);
+    gmlp::BatchPipeline pipeline{data.first, data.second, 10, 5};
+    std::size_t first_epoch_stalls = 0;
+    for (std::size_t epoch = 0; epoch < 4; ++epoch)
+    {
+        pipeline.rewind();
+        gmlp::ConstMatrixView batch_X;
+        gmlp::ConstMatrixView batch_y;
+        while (pipeline.next(batch_X, batch_y))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds{2});
+        }
+        if (epoch == 0)
+        {
+            first_epoch_stalls = pipeline.get_stall_count();
+        }
+    }
+    if (pipeline.get_stall_count() != first_epoch_stalls)
+    {
+        std::cout << "batch pipeline stalled " << pipeline.get_stall_count() - first_epoch_stalls
+                  << " times after a rewind" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// checks that a network saved to a stream loads back with the same weights,
+// also from the stream format without a header and as bfloat16
+bool check_network_streams()
+{
+    gmlp::init::DefaultRandomEngine engine{3};
+    const gmlp::Network net{gmlp::Classification, {4, 5, 3}, engine};
+    const std::vector<float> weights(net.get_weights().begin(), net.get_weights().end());
+    bool success = true;
+
+    std::stringstream ss;
+    net.save(ss);
+    const auto loaded = gmlp::Network::load(ss);
+    success = std::equal(weights.begin(), weights.end(), loaded.get_weights().begin())
+              && loaded.get_layers() == net.get_layers()
+              && loaded.get_topology()->get_target_type() == gmlp::Classification;
+
+    std::stringstream unversioned;
+    const auto write = [&unversioned](const auto value)
+    {
+        unversioned.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+    write(std::uint8_t{gmlp::Classification});
+    write(std::uint64_t{3});
+    for (const std::uint64_t size : {4, 5, 3})
+    {
+        write(size);
+    }
+    write(std::uint64_t{weights.size()});
+    for (const auto weight : weights)
+    {
+        write(weight);
+    }
+    const auto legacy = gmlp::Network::load(unversioned);
+    success = success && std::equal(weights.begin(), weights.end(), legacy.get_weights().begin())
+              && legacy.get_layers() == net.get_layers();
+
+    std::stringstream half;
+    net.save(half, gmlp::DataType::BFloat16);
+    const auto bf16 = gmlp::BasicNetwork<gmlp::bfloat16>::load(half);
+    for (std::size_t i = 0; i < weights.size(); ++i)
+    {
+        success = success && std::abs(static_cast<float>(bf16.get_weights()[i]) - weights[i]) <= std::abs(weights[i]) / 128;
+    }
+
+    std::stringstream truncated{ss.str().substr(0, ss.str().size() - 1)};
+    success = success && throws_runtime_error([&] { gmlp::Network::load(truncated); });
+    std::stringstream truncated_unversioned{unversioned.str().substr(0, unversioned.str().size() - 1)};
+    success = success && throws_runtime_error([&] { gmlp::Network::load(truncated_unversioned); });
+    if (!success)
+    {
+        std::cout << "network stream round trip failed" << std::endl;
+    }
+    return success;
+}
+
+// checks that a saved model file maps back with the same outputs and that
+// corrupt or truncated files are rejected
+bool check_model_files()
+{
+    const std::string path = "gmlp_test_model.bin";
+    gmlp::init::DefaultRandomEngine engine{4};
+    const gmlp::Network net{gmlp::Classification, {4, 6, 1}, engine};
+    const auto data = make_random_data(20, 4, 1, 4);
+    const auto pred = net.predict_batch(data.first);
+    net.save(path);
+    bool success = true;
+    for (const bool verify_checksum : {true, false})
+    {
+        const auto mapped = gmlp::Network::map(path, verify_checksum);
+        success = success && mapped.get_weights().is_mapped()
+                  && gmlp::mae(mapped.predict_batch(data.first), pred) == 0.0f;
+    }
+    const auto contents = read_file(path);
+    auto corrupt = contents;
+    corrupt[20] = static_cast<char>(gmlp::Regression); // the target type
+    write_file(path, corrupt);
+    success = success && throws_runtime_error([&] { gmlp::Network::map(path); });
+    corrupt = contents;
+    corrupt.back() ^= 1;
+    write_file(path, corrupt);
+    success = success && throws_runtime_error([&] { gmlp::Network::map(path); });
+    corrupt = contents;
+    corrupt[sizeof(gmlp::ModelHeader)] = 0; // the size of the input layer
+    write_file(path, corrupt);
+    success = success && throws_runtime_error([&] { gmlp::Network::map(path, false); });
+    write_file(path, contents.substr(0, contents.size() - 1));
+    success = success && throws_runtime_error([&] { gmlp::Network::map(path, false); });
+    std::remove(path.c_str());
+    if (!success)
+    {
+        std::cout << "model file round trip or validation failed" << std::endl;
+    }
+    return success;
+}
+
+// checks that scoring a population gives the same losses as mae() of the
+// predictions of its networks, with and without packed weights
+bool check_population_evaluate()
+{
+    gmlp::init::DefaultRandomEngine engine{5};
+    const auto topology = std::make_shared<const gmlp::Topology>(gmlp::Classification,
+                                                                 std::vector<std::size_t>{7, 9, 3});
+    const gmlp::Population population{topology, 11, engine, gmlp::transfer::Precision::Low};
+    for (const std::size_t n_rows : {5, 150})
+    {
+        const auto data = make_random_data(n_rows, 7, 3, 6);
+        for (const std::size_t n_threads : {1, 4})
+        {
+            gmlp::ThreadPool pool{n_threads};
+            const auto losses = population.evaluate(data.first, data.second, pool);
+            for (std::size_t i = 0; i < population.size(); ++i)
+            {
+                const auto net = population.get_network(i);
+                if (losses[i] != gmlp::mae(data.second, net.predict_batch(data.first)))
+                {
+                    std::cout << "population loss of individual " << i << " differs for " << n_rows
+                              << " rows and " << n_threads << " threads" << std::endl;
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// checks that the int8 dot products of every available instruction set match
+// the scalar ones exactly and that a quantized network stays close to the
+// float network it was built from
+bool check_quantized()
+{
+    using gmlp::kernels::Isa;
+    // odd sizes so that every kernel also runs its tails
+    const std::size_t m = 7;
+    const std::size_t n = 150;
+    const std::size_t lda = n + 3;
+    std::mt19937 random_engine{8};
+    std::uniform_int_distribution<int> weight{-127, 127};
+    std::uniform_int_distribution<int> input{0, 255};
+    std::vector<std::int8_t> A(m * lda);
+    std::vector<std::uint8_t> x(n);
+    for (auto& a : A)
+    {
+        a = static_cast<std::int8_t>(weight(random_engine));
+    }
+    for (auto& value : x)
+    {
+        value = static_cast<std::uint8_t>(input(random_engine));
+    }
+    std::vector<std::int32_t> reference(m);
+    gmlp::kernels::detail::make_table(Isa::Scalar).gemv_u8s8(m, n, A.data(), lda, x.data(), reference.data());
+    // the AVX512 table holds the VNNI kernel if the CPU has it
+    for (const auto isa : {Isa::SSE2, Isa::AVX2, Isa::AVX512, Isa::NEON})
+    {
+        if (!gmlp::kernels::detail::isa_available(isa))
+        {
+            continue;
+        }
+        std::vector<std::int32_t> y(m);
+        gmlp::kernels::detail::make_table(isa).gemv_u8s8(m, n, A.data(), lda, x.data(), y.data());
+        if (y != reference)
+        {
+            std::cout << gmlp::kernels::isa_name(isa) << " int8 dot products differ from scalar" << std::endl;
+            return false;
+        }
+    }
+
+    const auto data = make_random_data(500, 8, 2, 9);
+    gmlp::init::DefaultRandomEngine engine{9};
+    gmlp::Network net{gmlp::Regression, {8, 16, 2}, engine};
+    for (std::size_t epoch = 0; epoch < 20; ++epoch)
+    {
+        net.train(data.first, data.second, 0.1f, 16);
+    }
+    for (const auto granularity : {gmlp::Granularity::PerLayer, gmlp::Granularity::PerNeuron})
+    {
+        const gmlp::QuantizedNetwork quantized{net, data.first, granularity};
+        const auto report = gmlp::compare(net, quantized, data.first, data.second);
+        if (report.max_difference > 0.01f)
+        {
+            std::cout << "quantized network with granularity " << static_cast<int>(granularity)
+                      << " differs by " << report.max_difference << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// checks the Philox generator against known answers and that the genetic
+// algorithm with it gives the same result for any number of threads
+bool check_philox()
+{
+    using gmlp::init::Philox;
+    const auto zero = Philox{0}({0, 0, 0, 0});
+    const auto ones = Philox{~std::uint64_t{0}}({~0u, ~0u, ~0u, ~0u});
+    if (zero != Philox::Counter{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8}
+        || ones != Philox::Counter{0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd}
+        || !(Philox::to_uniform(0) > 0.0f) || !(Philox::to_uniform(~0u) < 1.0f))
+    {
+        std::cout << "philox differs from the known answers" << std::endl;
+        return false;
+    }
+    // gaps of tiny ratios exceed the range of std::size_t, so nothing changes
+    for (const float ratio : {1e-30f, 1e-45f})
+    {
+        std::vector<float> w1(1000, 1.0f);
+        std::vector<float> w2(1000, 2.0f);
+        gmlp::crossover(w1.data(), w2.data(), w1.size(), ratio, Philox{1}, 0, 0);
+        gmlp::mutate(w1.data(), w1.size(), ratio, 0.5f, Philox{1}, 0, 0);
+        if (std::count(w1.begin(), w1.end(), 1.0f) != 1000 || std::count(w2.begin(), w2.end(), 2.0f) != 1000)
+        {
+            std::cout << "genetic operators changed weights with ratio " << ratio << std::endl;
+            return false;
+        }
+    }
+    const auto data = make_random_data(100, 4, 1, 8);
+    std::vector<float> reference;
+    for (const std::size_t n_threads : {1, 3})
+    {
+        gmlp::ThreadPool pool{n_threads};
+        const auto models = gmlp::ga_optimize(3, 20, 0.3f, 0.1f, 0.5f, gmlp::Regression, {4, 5, 1},
+                                              data.first, data.second, std::uint64_t{9}, pool);
+        std::vector<float> result;
+        for (const auto& model : models)
+        {
+            result.push_back(model.loss);
+            result.insert(result.end(), model.net.get_weights().begin(), model.net.get_weights().end());
+        }
+        if (reference.empty())
+        {
+            reference = result;
+        }
+        else if (result != reference)
+        {
+            std::cout << "genetic algorithm differs with " << n_threads << " threads" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
 int main()
 {
+    if (!check_transfer_precision()
+        || !check_thread_pool_exceptions()
+        || !check_deterministic_training()
+        || !check_dataset_files()
+        || !check_csv()
+        || !check_batch_pipeline()
+        || !check_batch_pipeline_prefetch()
+        || !check_network_streams()
+        || !check_model_files()
+        || !check_population_evaluate()
+        || !check_quantized()
+        || !check_philox())
+    {
+        return 1;
+    }
+
 //    std::vector<std::vector<float>> X = {
 //        {2.7810836,2.550537003},
 //        {1.465489372,2.362125076},
@@ -31,25 +646,15 @@ int main()
 //        {0, 1},
 //    };
 
-    std::ifstream f{"/home/cblume/workspace/cbnn/data/boston.csv"};
-    std::vector<std::vector<float>> X;
-    std::vector<std::vector<float>> y;
-    while (!f.eof())
-    {
-        X.emplace_back(13);
-        y.emplace_back(1);
-        for (std::size_t i = 0; i < 13; ++i)
-        {
-            f >> X.back()[i];
-        }
-        f >> y.back()[0];
-    }
+    auto data = gmlp::csv::read("/home/cblume/workspace/cbnn/data/boston.csv");
+    const auto X = data.get_X();
+    const auto y = data.get_y();
 
     gmlp::init::DefaultRandomEngine engine{42};
 
     // Ref with 100 epochs
     // Class: MAE=0.1428
-    // Regre: MAE=2.7155
+    // Regre: MAE=2.8484
     const auto target_type = gmlp::Regression;
     gmlp::Network net{target_type, {13, 13, 1}, engine};
     net.print();
@@ -58,22 +663,22 @@ int main()
     if (target_type == gmlp::Classification)
     {
         learning_rate = 0.5f;
-        for (auto& value : y)
+        for (std::size_t i = 0; i < y.get_rows(); ++i)
         {
-            if (value[0] > 22)
+            if (y(i, 0) > 22)
             {
-                value[0] = 1;
+                y(i, 0) = 1;
             }
             else
             {
-                value[0] = 0;
+                y(i, 0) = 0;
             }
         }
     }
 
     const auto split = gmlp::split_train_test(X, y, 0.3f, engine);
 
-    std::cout << "training with " << split.X_train.size() << " samples" << std::endl;
+    std::cout << "training with " << split.X_train.get_rows() << " samples" << std::endl;
     for (std::size_t i = 0; i < 100; ++i)
     {
         const auto loss = net.train(split.X_train, split.y_train, learning_rate);
@@ -86,23 +691,19 @@ int main()
     auto loaded_net = gmlp::Network::load(ss);
 
     std::cout << "prediction" << std::endl;
-    std::vector<std::vector<float>> pred;
-    for (const auto& row : split.X_test)
-    {
-        pred.push_back(loaded_net.predict(row));
-    }
+    auto pred = loaded_net.predict_batch(split.X_test);
 
     if (target_type == gmlp::Classification)
     {
-        for (auto& value : pred)
+        for (std::size_t i = 0; i < pred.get_rows(); ++i)
         {
-            value[0] = value[0] > 0.5f ? 1.0f : 0.0f;
+            pred(i, 0) = pred(i, 0) > 0.5f ? 1.0f : 0.0f;
         }
     }
 
     for (std::size_t i = 0; i < 10; ++i)
     {
-        std::cout << "truth=" << split.y_test[i][0] << " " << "pred=" << pred[i][0] << std::endl;
+        std::cout << "truth=" << split.y_test(i, 0) << " " << "pred=" << pred(i, 0) << std::endl;
     }
 
     std::cout << "MAE=" << gmlp::mae(split.y_test, pred) << std::endl;
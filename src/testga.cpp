@@ -1,30 +1,20 @@
-#include <fstream>
 #include <sstream>
 
+#include "csv.h"
 #include "Network.h"
 #include "genetic.h"
 #include "utils.h"
 
 int main()
 {
-    std::ifstream f{"/home/cblume/workspace/cbnn/data/boston.csv"};
-    std::vector<std::vector<float>> X;
-    std::vector<std::vector<float>> y;
-    while (!f.eof())
-    {
-        X.emplace_back(13);
-        y.emplace_back(1);
-        for (std::size_t i = 0; i < 13; ++i)
-        {
-            f >> X.back()[i];
-        }
-        f >> y.back()[0];
-    }
+    auto data = gmlp::csv::read("/home/cblume/workspace/cbnn/data/boston.csv");
+    const auto X = data.get_X();
+    const auto y = data.get_y();
 
     gmlp::init::DefaultRandomEngine engine{42};
 
     const auto split = gmlp::split_train_test(X, y, 0.3f, engine);
-    std::cout << "training with " << split.X_train.size() << " samples" << std::endl;
+    std::cout << "training with " << split.X_train.get_rows() << " samples" << std::endl;
 
     const auto target_type = gmlp::Regression;
     const std::vector<std::size_t> layers = {13, 13, 1};
@@ -36,15 +26,15 @@ int main()
 
     if (target_type == gmlp::Classification)
     {
-        for (auto& value : y)
+        for (std::size_t i = 0; i < y.get_rows(); ++i)
         {
-            if (value[0] > 22)
+            if (y(i, 0) > 22)
             {
-                value[0] = 1;
+                y(i, 0) = 1;
             }
             else
             {
-                value[0] = 0;
+                y(i, 0) = 0;
             }
         }
     }
@@ -54,17 +44,13 @@ int main()
                                               layers, split.X_train, split.y_train, engine);
 
     std::cout << "prediction" << std::endl;
-    std::vector<std::vector<float>> pred;
-    for (const auto& row : split.X_test)
-    {
-        pred.push_back(population.front().net.predict(row));
-    }
+    auto pred = population.front().net.predict_batch(split.X_test);
 
     if (target_type == gmlp::Classification)
     {
-        for (auto& value : pred)
+        for (std::size_t i = 0; i < pred.get_rows(); ++i)
         {
-            value[0] = value[0] > 0.5f ? 1.0f : 0.0f;
+            pred(i, 0) = pred(i, 0) > 0.5f ? 1.0f : 0.0f;
         }
     }
 
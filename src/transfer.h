@@ -1,70 +1,159 @@
 #pragma once
 
+#include <cmath>
+#include <cstddef>
+
+#include "kernels.h"
+
 namespace gmlp
 {
 
 namespace transfer
 {
 
+using kernels::Precision;
+
 class Transfer
 {
 public:
     virtual ~Transfer() = default;
     virtual float call(float x) const = 0;
     virtual float call_deriv(float x) const = 0;
+    // applies the transfer in place to the n values of a layer buffer
+    virtual void apply(float* x, std::size_t n, Precision precision) const = 0;
+    // multiplies the n deltas by the derivative at the transfer outputs y
+    virtual void apply_deriv(const float* y, float* deltas, std::size_t n) const = 0;
+
+    void apply(float* x, const std::size_t n) const
+    {
+        apply(x, n, Precision::Exact);
+    }
 };
 
-class Linear : public Transfer
+// Compile-time dispatched whole-buffer versions of a transfer function T.
+// These are plain loops over T's static functions which the compiler can
+// inline and vectorize.
+template<typename T>
+void apply(float* x, const std::size_t n, const Precision precision = Precision::Exact)
+{
+    if (precision != Precision::Exact)
+    {
+        T::approximate(x, n, precision);
+        return;
+    }
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        x[i] = T::function(x[i]);
+    }
+}
+
+template<typename T>
+void apply_deriv(const float* y, float* deltas, const std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        deltas[i] *= T::derivative(y[i]);
+    }
+}
+
+// Implements the Transfer interface for a class T providing the static
+// functions T::function(x) and T::derivative(y) where y = T::function(x).
+// The virtual call is paid once per layer buffer instead of once per value.
+// T may provide T::approximate(x, n, precision) for the inexact precisions.
+template<typename T>
+class TransferImpl : public Transfer
 {
 public:
-    float call(float x) const override
+    using Transfer::apply;
+
+    static void approximate(float* x, const std::size_t n, Precision)
+    {
+        transfer::apply<T>(x, n);
+    }
+
+    float call(const float x) const override
+    {
+        return T::function(x);
+    }
+
+    float call_deriv(const float y) const override
+    {
+        return T::derivative(y);
+    }
+
+    void apply(float* x, const std::size_t n, const Precision precision) const override
+    {
+        transfer::apply<T>(x, n, precision);
+    }
+
+    void apply_deriv(const float* y, float* deltas, const std::size_t n) const override
+    {
+        transfer::apply_deriv<T>(y, deltas, n);
+    }
+};
+
+class Linear : public TransferImpl<Linear>
+{
+public:
+    static float function(const float x)
     {
         return x;
     }
 
-    float call_deriv(float) const override
+    static float derivative(float)
     {
         return 1.0f;
     }
 };
 
-class Sigmoid : public Transfer
+class Sigmoid : public TransferImpl<Sigmoid>
 {
 public:
-    float call(float x) const override
+    static float function(const float x)
     {
         return 1.0f / (1.0f + std::exp(-x));
     }
 
-    float call_deriv(float x_sigmoid) const override
+    static void approximate(float* x, const std::size_t n, const Precision precision)
+    {
+        kernels::sigmoid(x, n, precision);
+    }
+
+    static float derivative(const float x_sigmoid)
     {
         return x_sigmoid * (1.0f - x_sigmoid);
     }
 };
 
-class Tanh : public Transfer
+class Tanh : public TransferImpl<Tanh>
 {
 public:
-    float call(float x) const override
+    static float function(const float x)
     {
         return std::tanh(x);
     }
 
-    float call_deriv(float x_tanh) const override
+    static void approximate(float* x, const std::size_t n, const Precision precision)
+    {
+        kernels::tanh(x, n, precision);
+    }
+
+    static float derivative(const float x_tanh)
     {
         return 1 - x_tanh * x_tanh;
     }
 };
 
-class Relu : public Transfer
+class Relu : public TransferImpl<Relu>
 {
 public:
-    float call(float x) const override
+    static float function(const float x)
     {
         return x > 0.0f ? x : 0.0f;
     }
 
-    float call_deriv(float x) const override
+    // relu(x) > 0 if and only if x > 0 so this also holds for the output
+    static float derivative(const float x)
     {
         return x > 0.0f ? 1.0f : 0.0f;
     }
@@ -1,8 +1,10 @@
 #pragma once
 
+#include <cmath>
 #include <vector>
 
 #include "init.h"
+#include "Matrix.h"
 
 namespace gmlp
 {
@@ -15,66 +17,103 @@ struct Split
     std::vector<std::vector<float>> y_test;
 };
 
-inline Split split_train_test(const std::vector<std::vector<float>>& X,
-                              const std::vector<std::vector<float>>& y,
-                              const float test_ratio,
-                              init::RandomEngine& random_engine)
+struct MatrixSplit
 {
+    Matrix X_train;
+    Matrix X_test;
+    Matrix y_train;
+    Matrix y_test;
+};
+
+inline MatrixSplit split_train_test(const ConstMatrixView X,
+                                    const ConstMatrixView y,
+                                    const float test_ratio,
+                                    init::RandomEngine& random_engine)
+{
+    assert(X.get_rows() == y.get_rows());
     std::uniform_real_distribution<float> uniform;
-    Split split;
-    for (std::size_t i = 0; i < X.size(); ++i)
+    std::vector<bool> is_test(X.get_rows());
+    std::size_t n_test = 0;
+    for (std::size_t i = 0; i < X.get_rows(); ++i)
     {
-        if (uniform(random_engine) < test_ratio)
-        {
-            split.X_test.push_back(X[i]);
-            split.y_test.push_back(y[i]);
-        }
-        else
-        {
-            split.X_train.push_back(X[i]);
-            split.y_train.push_back(y[i]);
-        }
+        is_test[i] = uniform(random_engine) < test_ratio;
+        n_test += is_test[i];
+    }
+    const auto n_train = X.get_rows() - n_test;
+    MatrixSplit split{{n_train, X.get_cols()}, {n_test, X.get_cols()},
+                      {n_train, y.get_cols()}, {n_test, y.get_cols()}};
+    std::size_t train = 0;
+    std::size_t test = 0;
+    for (std::size_t i = 0; i < X.get_rows(); ++i)
+    {
+        auto& X_part = is_test[i] ? split.X_test : split.X_train;
+        auto& y_part = is_test[i] ? split.y_test : split.y_train;
+        const auto row = is_test[i] ? test++ : train++;
+        std::copy(X.get_row(i), X.get_row(i) + X.get_cols(), X_part.get_row(row));
+        std::copy(y.get_row(i), y.get_row(i) + y.get_cols(), y_part.get_row(row));
     }
     return split;
 }
 
-inline float mae(const std::vector<std::vector<float>>& truth,
-                 const std::vector<std::vector<float>>& pred)
+inline Split split_train_test(const std::vector<std::vector<float>>& X,
+                              const std::vector<std::vector<float>>& y,
+                              const float test_ratio,
+                              init::RandomEngine& random_engine)
+{
+    const auto split = split_train_test(to_matrix(X), to_matrix(y), test_ratio, random_engine);
+    return {to_rows(split.X_train), to_rows(split.X_test),
+            to_rows(split.y_train), to_rows(split.y_test)};
+}
+
+inline float mae(const ConstMatrixView truth,
+                 const ConstMatrixView pred)
 {
-    assert(truth.size() == pred.size());
+    assert(truth.get_rows() == pred.get_rows());
+    assert(truth.get_cols() == pred.get_cols());
     float sum = 0.0f;
-    for (std::size_t i = 0; i < truth.size(); ++i)
+    for (std::size_t i = 0; i < truth.get_rows(); ++i)
     {
         float sub = 0.0f;
-        assert(truth[i].size() == pred[i].size());
-        for (std::size_t j = 0; j < truth[i].size(); ++j)
+        for (std::size_t j = 0; j < truth.get_cols(); ++j)
         {
-            sub += std::abs(truth[i][j] - pred[i][j]);
+            sub += std::abs(truth(i, j) - pred(i, j));
         }
-        sub /= static_cast<float>(truth[i].size());
+        sub /= static_cast<float>(truth.get_cols());
         sum += sub;
     }
-    return sum / static_cast<float>(truth.size());
+    return sum / static_cast<float>(truth.get_rows());
 }
 
-inline float mse(const std::vector<std::vector<float>>& truth,
+inline float mae(const std::vector<std::vector<float>>& truth,
                  const std::vector<std::vector<float>>& pred)
 {
-    assert(truth.size() == pred.size());
+    return mae(to_matrix(truth), to_matrix(pred));
+}
+
+inline float mse(const ConstMatrixView truth,
+                 const ConstMatrixView pred)
+{
+    assert(truth.get_rows() == pred.get_rows());
+    assert(truth.get_cols() == pred.get_cols());
     float sum = 0.0f;
-    for (std::size_t i = 0; i < truth.size(); ++i)
+    for (std::size_t i = 0; i < truth.get_rows(); ++i)
     {
         float sub = 0.0f;
-        assert(truth[i].size() == pred[i].size());
-        for (std::size_t j = 0; j < truth[i].size(); ++j)
+        for (std::size_t j = 0; j < truth.get_cols(); ++j)
         {
-            const float diff = truth[i][j] - pred[i][j];
+            const float diff = truth(i, j) - pred(i, j);
             sub += diff * diff;
         }
-        sub /= static_cast<float>(truth[i].size());
+        sub /= static_cast<float>(truth.get_cols());
         sum += sub;
     }
-    return sum / static_cast<float>(truth.size());
+    return sum / static_cast<float>(truth.get_rows());
+}
+
+inline float mse(const std::vector<std::vector<float>>& truth,
+                 const std::vector<std::vector<float>>& pred)
+{
+    return mse(to_matrix(truth), to_matrix(pred));
 }
 
 }